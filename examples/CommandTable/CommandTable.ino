@@ -0,0 +1,83 @@
+// Commands declared in a table kept entirely in flash.
+//
+// addCommand() allocates a small block of RAM for every command.
+// addCommands() uses a sorted table in flash instead, so a sketch with
+// many commands costs (almost) no RAM for them, and nothing is sorted at
+// startup.
+#include <SdFat.h>
+#include <SimpleSerialShell.h>
+
+////////////////////////////////////////////////////////////////////////////////
+int echo(int argc, char **argv)
+{
+    auto lastArg = argc - 1;
+    for ( int i = 1; i < argc; i++) {
+
+        shell.print(argv[i]);
+
+        if (i < lastArg)
+            shell.print(F(" "));
+    }
+    shell.println();
+
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int showID(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    shell.println(F( "Running " __FILE__ ", Built " __DATE__));
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int sum(int argc, char **argv)
+{
+    int aSum = 0;
+
+    for ( int i = 1; i < argc; i++) {
+        aSum += atoi(argv[i]);
+    }
+    shell.println(aSum);
+
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Names and usage strings must be in flash too.
+//
+constexpr char echoName[] PROGMEM = "echo";
+constexpr char echoUsage[] PROGMEM = "<words...>  print the words";
+constexpr char idName[] PROGMEM = "id?";
+constexpr char idUsage[] PROGMEM = "which sketch is this?";
+constexpr char sumName[] PROGMEM = "sum";
+constexpr char sumUsage[] PROGMEM = "<numbers...>  add them up";
+
+// Entries must be sorted by name (ignoring case).  The last field is
+// for a task (NULL: a plain command).
+constexpr SimpleSerialShell::CommandEntry commands[] PROGMEM = {
+    { echoName, echo,   false, true,  echoUsage, NULL },
+    { idName,   showID, false, false, idUsage,   NULL },
+    { sumName,  sum,    false, true,  sumUsage,  NULL },
+};
+static_assert(SimpleSerialShell::isSorted(commands), "commands[] must be sorted by name");
+
+////////////////////////////////////////////////////////////////////////////////
+void setup() {
+    Serial.begin(115200);
+    while (!Serial) {
+        // wait for serial port to connect. Needed for native USB port only
+    }
+
+    shell.attach(Serial);
+    shell.addCommands(commands);
+
+    shell.execute("help");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void loop() {
+    shell.executeIfInput();
+}
@@ -0,0 +1,72 @@
+//
+// commandDispatchBenchmark.ino
+//
+// Measure how long the shell takes to find and run a command
+// as the number of registered commands grows (10, 100, 1000).
+
+// UnixHostDuino emulation needs this include
+// (it's not picked up "for free" by Arduino IDE)
+//
+#include <Arduino.h>
+#include <SdFat.h>
+#include <SimpleSerialShell.h>
+
+static const int LOOKUPS = 10000;
+
+int nothing(int argc, char **argv)
+{
+    return EXIT_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// register commands "cmd0000" ... until the shell has 'total' of them
+// (names must outlive the shell, so they are never freed)
+//
+void registerCommands(int total)
+{
+    static int registered = 0;
+
+    for (; registered < total; registered++) {
+        char * name = (char *) malloc(8);
+        snprintf(name, 8, "cmd%04d", registered);
+        shell.addCommand((const __FlashStringHelper *) name, nothing, false, false, NULL);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void benchmark(int total)
+{
+    char line[8];
+
+    registerCommands(total);
+    shell.execute("cmd0000");   // first lookup (re)builds the index
+
+    unsigned long start = micros();
+    for (int i = 0; i < LOOKUPS; i++) {
+        // spread lookups across the whole (sorted) table
+        snprintf(line, sizeof(line), "cmd%04d", (int)((i * 7919L) % total));
+        shell.execute(line);
+    }
+    unsigned long elapsed = micros() - start;
+
+    Serial.print(total);
+    Serial.print(F(" commands: "));
+    Serial.print((float) elapsed * 1000.0 / LOOKUPS);
+    Serial.println(F(" ns per execute()"));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void setup() {
+    Serial.begin(115200);
+    while (!Serial);
+    shell.attach(Serial);
+
+    benchmark(10);
+    benchmark(100);
+    benchmark(1000);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void loop() {
+    exit(0);
+}
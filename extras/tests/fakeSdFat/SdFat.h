@@ -0,0 +1,175 @@
+// SdFat.h
+//
+// Minimal stand-in for the SdFat library so the shell can be built and
+// exercised on the host (UnixHostDuino).  Only what the shell uses is
+// provided.  The "card" is a single in-RAM directory of named files.
+//
+#ifndef FAKE_SDFAT_H
+#define FAKE_SDFAT_H
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <map>
+#include <string>
+
+#ifndef O_RDONLY
+#define O_RDONLY 0x00
+#endif
+#ifndef O_CREAT
+#define O_CREAT 0x40
+#endif
+#ifndef O_TRUNC
+#define O_TRUNC 0x200
+#endif
+#define O_READ 0x00
+#define O_WRITE 0x01
+#define O_AT_END 0x4000
+
+class FakeCard {
+    public:
+        typedef std::map<std::string, std::string> Files;
+
+        static Files & files(void) {
+            static Files theFiles;
+            return theFiles;
+        }
+
+        // directory entries read so far (each costs bus time on a card)
+        static unsigned long & entriesRead(void) {
+            static unsigned long count;
+            return count;
+        }
+
+        // file writes so far (each costs at least a sector on a card)
+        static unsigned long & writes(void) {
+            static unsigned long count;
+            return count;
+        }
+
+        // while set, writes fail
+        static bool & full(void) {
+            static bool isFull;
+            return isFull;
+        }
+};
+
+class FatVolume {
+    public:
+        bool cwd(char * buff, size_t size) {
+            strncpy(buff, "/", size);
+            return true;
+        }
+};
+
+class SdFile : public Stream {
+    public:
+        SdFile(void) : m_open(false), m_dir(false), m_pos(0) {}
+
+        bool open(const char * path, int oflag = O_RDONLY) {
+            close();
+            if (strcmp(path, "/") == 0) {
+                m_dir = m_open = true;
+                m_pos = 0;
+                return true;
+            }
+            FakeCard::Files & f = FakeCard::files();
+            if (f.find(path) == f.end()) {
+                if (!(oflag & O_CREAT)) {
+                    return false;
+                }
+                f[path] = "";
+            }
+            else if ((oflag & O_WRITE) && (oflag & O_TRUNC)) {
+                f[path].clear();
+            }
+            m_name = path;
+            m_open = true;
+            m_dir = false;
+            m_pos = (oflag & O_AT_END) ? f[path].size() : 0;
+            return true;
+        }
+
+        // iterate the root directory
+        bool openNext(SdFile * dir, int oflag = O_RDONLY) {
+            FakeCard::Files & f = FakeCard::files();
+            if (!dir->m_dir) {
+                return false;
+            }
+            FakeCard::Files::iterator it = dir->m_pos++ == 0 ? f.begin() : f.upper_bound(dir->m_last);
+            if (it == f.end()) {
+                return false;
+            }
+            FakeCard::entriesRead()++;
+            dir->m_last = it->first;    // where to carry on from
+            return open(it->first.c_str(), oflag);
+        }
+
+        bool getName(char * buff, size_t size) {
+            strncpy(buff, m_name.c_str(), size);
+            if (size) {
+                buff[size - 1] = '\0';
+            }
+            return m_open;
+        }
+
+        bool close(void) {
+            m_open = m_dir = false;
+            m_name.clear();
+            return true;
+        }
+
+        bool isOpen(void) const { return m_open; }
+        uint32_t fileSize(void) const { return data().size(); }
+        uint32_t curPosition(void) const { return m_pos; }
+
+        int read(void * buf, size_t n) {
+            const std::string & d = data();
+            size_t k = d.size() - m_pos < n ? d.size() - m_pos : n;
+            memcpy(buf, d.data() + m_pos, k);
+            m_pos += k;
+            return k;
+        }
+
+        virtual size_t write(const uint8_t * buf, size_t n) {
+            if (!m_open || m_dir || FakeCard::full()) {
+                return 0;
+            }
+            FakeCard::writes()++;
+            std::string & d = FakeCard::files()[m_name];
+            d.replace(m_pos, n, (const char *) buf, n);
+            m_pos += n;
+            return n;
+        }
+
+        virtual size_t write(uint8_t c) { return write(&c, 1); }
+        virtual int available() { return data().size() - m_pos; }
+        virtual int read() { return available() ? (uint8_t) data()[m_pos++] : -1; }
+        virtual int peek() { return available() ? (uint8_t) data()[m_pos] : -1; }
+        virtual void flush() {}
+
+    private:
+        const std::string & data(void) const {
+            static const std::string none;
+            FakeCard::Files & f = FakeCard::files();
+            FakeCard::Files::const_iterator it = f.find(m_name);
+            return (m_dir || it == f.end()) ? none : it->second;
+        }
+
+        bool m_open;
+        bool m_dir;
+        size_t m_pos;
+        std::string m_name;
+        std::string m_last;     // a directory's latest entry
+};
+
+class SdFat {
+    public:
+        FatVolume * vol(void) {
+            return &m_vol;
+        }
+
+    private:
+        FatVolume m_vol;
+};
+
+#endif // FAKE_SDFAT_H
@@ -0,0 +1,77 @@
+//
+// globBenchmark.ino
+//
+// Measure how long a wildcard argument takes to expand in a directory
+// of 10,000 files, reading the card each time and with the directory
+// cache (setGlobCache()).  Uses the fake SdFat volume in ../fakeSdFat.
+
+// UnixHostDuino emulation needs this include
+// (it's not picked up "for free" by Arduino IDE)
+//
+#include <Arduino.h>
+#include <SdFat.h>
+#include <SimpleSerialShell.h>
+
+static const int FILES = 10000;
+static const int GLOBS = 100;
+
+SdFat sd;
+static char cache[FILES * 12 + 16];    // "L00000.CSV" and its NUL, each
+
+int matches;
+
+// a globbing command that just counts its arguments
+int count(int argc, char **argv)
+{
+    matches = argc - 1;
+    return EXIT_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void benchmark(const char * title)
+{
+    char line[24];
+
+    FakeCard::entriesRead() = 0;
+    unsigned long start = micros();
+    for (int i = 0; i < GLOBS; i++) {
+        // a different file each time
+        snprintf(line, sizeof(line), "count L%05d.CS?", (int)((i * 7919L) % FILES));
+        shell.execute(line);
+    }
+    unsigned long elapsed = micros() - start;
+
+    Serial.print(title);
+    Serial.print(F(": "));
+    Serial.print((float) elapsed / GLOBS);
+    Serial.print(F(" us and "));
+    Serial.print((float) FakeCard::entriesRead() / GLOBS);
+    Serial.print(F(" entries read per glob, "));
+    Serial.print(matches);
+    Serial.println(F(" matches"));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void setup() {
+    char name[16];
+
+    Serial.begin(115200);
+    while (!Serial);
+    shell.attach(Serial);
+
+    for (int i = 0; i < FILES; i++) {
+        snprintf(name, sizeof(name), "L%05d.CSV", i);
+        FakeCard::files()[name] = "";
+    }
+    shell.addSD(&sd);
+    shell.addCommand(F("count"), count, true, false, NULL);
+
+    benchmark("card");
+    SimpleSerialShell::setGlobCache(cache, sizeof(cache));
+    benchmark("cache");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void loop() {
+    exit(0);
+}
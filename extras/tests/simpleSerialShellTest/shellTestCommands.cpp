@@ -1,6 +1,7 @@
 // shellTestCommands.cpp
 //
 #include <Arduino.h>
+#include <SdFat.h>
 #include <SimpleSerialShell.h>
 #include "shellTestHelpers.h"
 
@@ -43,8 +44,192 @@ int sum(int argc, char **argv)
     return aSum;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// a task: print one number per turn
+// "countdown 3" prints 3, 2, 1 over three turns.
+//
+int countdown(int argc, char **argv, SimpleSerialShell::TaskState & state)
+{
+    if (state.cancelled) {
+        shell.println(F("stopped"));
+        return EXIT_FAILURE;
+    }
+    if (state.step++ == 0) {
+        state.value = argc > 1 ? atoi(argv[1]) : 1;
+    }
+    if (state.value == 0) {
+        return EXIT_SUCCESS;
+    }
+    shell.println(state.value--);
+    return SimpleSerialShell::TASK_RUNNING;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// how many arguments, after wildcards are expanded
+// "nargs *.TXT" returns how many .TXT files there are.
+//
+int nargs(int argc, char **argv)
+{
+    (void) argv;
+    return argc - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// count the files matching each argument, walking them one at a time
+// "countFiles *.TXT" prints how many .TXT files there are.
+//
+int countFiles(int argc, char **argv)
+{
+    int total = 0;
+
+    for (int i = 1; i < argc; i++) {
+        SimpleSerialShell::GlobIterator files(argv[i]);
+        int n = 0;
+        while (files.next()) {
+            n++;
+        }
+        shell.println(n);
+        total += n;
+    }
+
+    return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// where command output goes: the shell, or a file while redirected
+//
+Stream * console = &shell;
+
+Stream * redirectConsole(Stream * c, SdFile * f)
+{
+    Stream * was = console;
+    console = c ? c : f;
+    return was;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// print some bytes to the console, one at a time
+// "fill 3" prints "xxx".
+//
+int fill(int argc, char **argv)
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1;
+
+    for (int i = 0; i < n; i++) {
+        console->write('x');
+    }
+
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// count the lines of input
+// "countLines < LOG.TXT" returns how many lines LOG.TXT has.
+//
+int countLines(int argc, char **argv)
+{
+    int n = 0;
+    int c;
+
+    (void) argc;
+    (void) argv;
+
+    while ((c = shell.read()) >= 0) {
+        if (c == '\n') {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// a task: take some turns without printing anything, then say so
+// "idle 3" prints "done" on its fourth turn.
+//
+int idle(int argc, char **argv, SimpleSerialShell::TaskState & state)
+{
+    if (state.cancelled || state.step++ == (argc > 1 ? atoi(argv[1]) : 1)) {
+        shell.println(F("done"));
+        return EXIT_SUCCESS;
+    }
+    return SimpleSerialShell::TASK_RUNNING;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// a task that counts the lines of input as they come
+// "idle 3 | tally" returns 1.
+//
+int tally(int argc, char **argv, SimpleSerialShell::TaskState & state)
+{
+    int c;
+
+    (void) argc;
+    (void) argv;
+
+    while ((c = shell.read()) >= 0) {
+        if (c == '\n') {
+            state.value++;
+        }
+    }
+
+    return shell.inputEnded() || state.cancelled ? state.value : SimpleSerialShell::TASK_RUNNING;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// a clock for ShellHub that only moves when told to
+// "tick 300" makes 300 microseconds go by.
+//
+unsigned long fakeNow;
+
+unsigned long fakeMicros(void)
+{
+    return fakeNow;
+}
+
+int tick(int argc, char **argv)
+{
+    fakeNow += argc > 1 ? atol(argv[1]) : 1;
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// commands kept in a flash table, sorted by name (ignoring case)
+// "double 21" returns 42, "Negate 5" returns -5.
+//
+int doubleIt(int argc, char **argv)
+{
+    return argc > 1 ? 2 * atoi(argv[1]) : 0;
+}
+
+int negate(int argc, char **argv)
+{
+    return argc > 1 ? -atoi(argv[1]) : 0;
+}
+
+constexpr char doubleName[] PROGMEM = "double";
+constexpr char doubleUsage[] PROGMEM = "<n>  twice n";
+constexpr char negateName[] PROGMEM = "Negate";
+constexpr char sumName[] PROGMEM = "sum";   // hidden by the sum added above
+
+constexpr SimpleSerialShell::CommandEntry tableCommands[] PROGMEM = {
+    { doubleName, doubleIt, false, false, doubleUsage, NULL },
+    { negateName, negate,   false, false, NULL,        NULL },
+    { sumName,    negate,   false, false, NULL,        NULL },
+};
+static_assert(SimpleSerialShell::isSorted(tableCommands), "tableCommands[] must be sorted by name");
 
 void addTestCommands(void) {
-    shell.addCommand(F("echo"), echo);
-    shell.addCommand(F("sum"), sum);
+    shell.addCommand(F("echo"), echo, false, false, NULL);
+    shell.addCommand(F("sum"), sum, false, false, NULL);
+    shell.addTask(F("countdown"), countdown, false, false, NULL);
+    shell.addCommand(F("countFiles"), countFiles, SimpleSerialShell::GLOB_STREAM, false, NULL);
+    shell.addCommand(F("nargs"), nargs, true, false, NULL);
+    shell.addCommand(F("fill"), fill, false, false, NULL);
+    shell.addCommand(F("countLines"), countLines, false, false, NULL);
+    shell.addTask(F("idle"), idle, false, false, NULL);
+    shell.addTask(F("tally"), tally, false, false, NULL);
+    shell.addCommand(F("tick"), tick, false, false, NULL);
+    shell.addCommands(tableCommands);
+    shell.addRedirector(redirectConsole);
 }
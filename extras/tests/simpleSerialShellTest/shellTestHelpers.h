@@ -30,3 +30,5 @@ class SimMonitor: public Stream {
 };
 
 void addTestCommands(void);
+unsigned long fakeMicros(void);     // ShellHub clock, moved by "tick n"
+
@@ -20,18 +20,24 @@
 
 // These tests depend on the Arduino "AUnit" library
 #include <AUnit.h>
+#include <SdFat.h>
 #include <SimpleSerialShell.h>
+#include <ShellHub.h>
 //#include <Streaming.h>
 #include "shellTestHelpers.h"
 
 using namespace aunit;
 
 SimMonitor terminal;
+SimMonitor remoteTerminal;
+SizedSerialShell<> remoteShell;  // a second session
 
 void prepForTests(void)
 {
     terminal.init();
     shell.resetBuffer();
+    remoteTerminal.init();
+    remoteShell.resetBuffer();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -67,6 +73,56 @@ testF(ShellTest, execute) {
     assertEqual(errNo, 6);      // sum(...) returned 6
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// shell.execute( string ) leaves a half-typed line alone?
+testF(ShellTest, executeWhileTyping) {
+
+    terminal.pressKeys("echo typed");
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "echo typed");
+
+    assertEqual(shell.execute("echo from sketch"), 0);
+    assertEqual(terminal.getline(), "from sketch\r\n");
+
+    terminal.pressKeys(" line\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), " line\r\ntyped line\r\n> ");
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// commands from a flash table are found, and merged into help in order?
+class Capture : public Stream {
+    public:
+        String text;
+        virtual size_t write(uint8_t c) { text += (char) c; return 1; }
+        virtual int available() { return 0; }
+        virtual int read() { return -1; }
+        virtual int peek() { return -1; }
+};
+
+testF(ShellTest, commandTable) {
+
+    assertEqual(shell.execute("double 21"), 42);
+    assertEqual(shell.execute("NEGATE 5"), -5);     // any case
+    assertEqual(shell.execute("sum 1 2"), 3);       // addCommand()'s wins
+
+    Capture help;
+    shell.attach(help);
+    shell.execute("help");
+    shell.attach(terminal);
+    terminal.getline();
+    int countdown = help.text.indexOf("\n  countdown  ");
+    int twice = help.text.indexOf("\n  double  <n>  twice n\r\n");
+    int echo = help.text.indexOf("\n  echo  ");
+    int negate = help.text.indexOf("\n  Negate  \r\n");
+    int sum = help.text.indexOf("\n  sum  ");
+    assertTrue(countdown >= 0 && countdown < twice);
+    assertTrue(twice < echo);
+    assertTrue(echo < negate);
+    assertTrue(negate < sum);
+    assertEqual(help.text.indexOf("\n  sum  ", sum + 1), -1);   // once
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // shell.execute( string ) fails for missing command?
 testF(ShellTest, missingCommand) {
@@ -79,6 +135,55 @@ testF(ShellTest, missingCommand) {
     assertEqual(terminal.getline(), "\"echoNOT\": -1: command not found\r\n");
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// too many arguments are refused, not dropped
+testF(ShellTest, tooManyArguments) {
+
+    int response = shell.execute("sum 1 2 3 4 5 6 7 8 9 10");
+    assertEqual(response, EXIT_FAILURE);
+    assertEqual(terminal.getline(), "too many arguments\r\n");
+
+    response = shell.execute("sum 1 2 3 4 5 6 7 8 9");
+    assertEqual(response, 45);
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// a typed line too long for the buffer is refused, not run cut short?
+testF(ShellTest, typedLineTooLong) {
+
+    terminal.pressKeys("echo ");
+    for (int i = 0; i < 100; i++) {     // more than the line holds
+        terminal.pressKey('x');
+        assertFalse(shell.executeIfInput());
+        terminal.getline();
+    }
+    terminal.pressKey('\r');
+    assertTrue(shell.executeIfInput());
+    assertEqual(shell.lastErrNo(), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "\r\nline too long\r\n> ");
+
+    // the next line is fine
+    terminal.pressKeys("echo ok\r");
+    shell.executeIfInput();
+    assertEqual(shell.lastErrNo(), 0);
+    assertEqual(terminal.getline(), "echo ok\r\nok\r\n> ");
+
+    // a line that ran over, then was cut back, is taken
+    terminal.pressKeys("sum 2 3 ");
+    for (int i = 0; i < 100; i++) {
+        terminal.pressKey('x');
+        assertFalse(shell.executeIfInput());
+        terminal.getline();
+    }
+    terminal.pressKey('\b');
+    assertFalse(shell.executeIfInput());
+    terminal.getline();
+    terminal.pressKey('\r');
+    assertTrue(shell.executeIfInput());
+    assertEqual(shell.lastErrNo(), 5);
+    assertEqual(terminal.getline(), "\r\n> ");
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // shell.executeIfInput() from stream works?
 testF(ShellTest, executeIfInput) {
@@ -103,7 +208,7 @@ testF(ShellTest, executeIfInput) {
     errNo = shell.lastErrNo();
     assertEqual(errNo, 0);    // OK or no errors
 
-    assertEqual(terminal.getline(), "\r\nhello world\r\n");
+    assertEqual(terminal.getline(), "\r\nhello world\r\n> ");
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -122,7 +227,15 @@ testF(ShellTest, cancelLine) {
     terminal.pressKey(0x15);   // CTRL('U')
     response = shell.executeIfInput();
     aLine = terminal.getline();
-    assertEqual(aLine, "XXX\r\n");
+    // back to the prompt, then blank out the line (and the cursor cell)
+    String blanked = "\r> ";
+    for (size_t i = 0; i <= strlen(badCmd); i++) {
+        blanked += ' ';
+    }
+    for (size_t i = 0; i <= strlen(badCmd); i++) {
+        blanked += '\b';
+    }
+    assertEqual(aLine, blanked);
 
     const char* echoCmd = "echo aWord";
     terminal.pressKeys(echoCmd);
@@ -135,7 +248,7 @@ testF(ShellTest, cancelLine) {
     errNo = shell.lastErrNo();
     assertEqual(errNo, 0);    // OK or no errors
 
-    assertEqual(terminal.getline(), "\r\naWord\r\n");
+    assertEqual(terminal.getline(), "\r\naWord\r\n> ");
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -151,10 +264,10 @@ testF(ShellTest, retypeLine) {
     assertFalse(response);
     String aLine = terminal.getline();  // flush output
 
-    terminal.pressKey(0x12);   // CTRL('R') retype line
+    terminal.pressKey(0x0C);   // CTRL('L') retype line
     response = shell.executeIfInput();
     aLine = terminal.getline();
-    assertEqual(aLine, "\r\necho howdy doodie");
+    assertEqual(aLine, "\r\n> echo howdy doodie");
 
     terminal.pressKey('\r');
     response = shell.executeIfInput();
@@ -163,9 +276,745 @@ testF(ShellTest, retypeLine) {
     errNo = shell.lastErrNo();
     assertEqual(errNo, 0);    // OK or no errors
 
-    assertEqual(terminal.getline(), "\r\nhowdy doodie\r\n");
+    assertEqual(terminal.getline(), "\r\nhowdy doodie\r\n> ");
 };
 
+//////////////////////////////////////////////////////////////////////////////
+//  find an earlier line with CTRL('R') (incremental reverse search)
+testF(ShellTest, reverseSearch) {
+
+    const char* pattern = "alp";
+    bool response = false;
+
+    terminal.pressKeys("echo alpha\r");
+    shell.executeIfInput();
+    terminal.pressKeys("echo beta\r");
+    shell.executeIfInput();
+    String aLine = terminal.getline();  // flush output
+
+    terminal.pressKey(0x12);   // CTRL('R') search history
+    response = shell.executeIfInput();
+    assertFalse(response);
+    for (int i = 0; pattern[i] != '\0'; i++) {
+        aLine = terminal.getline();  // flush output
+        terminal.pressKey(pattern[i]);
+        response = shell.executeIfInput();
+        assertFalse(response);
+    }
+    aLine = terminal.getline();
+    assertTrue(aLine.endsWith("(reverse-i-search)`alp': echo alpha"));
+
+    terminal.pressKey('\r');  // run what was found
+    response = shell.executeIfInput();
+    assertTrue(response);
+    assertTrue(terminal.getline().endsWith("\r\nalpha\r\n> "));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Tab completes command names
+testF(ShellTest, tabCompletion) {
+
+    bool response = false;
+    int errNo = 0;
+
+    terminal.pressKeys("ec");
+    response = shell.executeIfInput();
+    String aLine = terminal.getline();  // flush output
+
+    terminal.pressKey('\t');
+    response = shell.executeIfInput();
+    assertFalse(response);
+    assertEqual(terminal.getline(), "ho ");
+
+    terminal.pressKeys("done\r");
+    response = shell.executeIfInput();
+    assertTrue(response);
+    errNo = shell.lastErrNo();
+    assertEqual(errNo, 0);    // OK or no errors
+
+    assertTrue(terminal.getline().endsWith("\r\ndone\r\n> "));
+
+    // the table's "sum" is hidden by the one added, so "sum" is the only match
+    terminal.pressKeys("su");
+    shell.executeIfInput();
+    terminal.getline();
+    terminal.pressKey('\t');
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "m ");
+    terminal.pressKey(0x03);
+    shell.executeIfInput();
+    terminal.getline();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  two sessions edit their lines independently
+testF(ShellTest, twoSessions) {
+
+    bool response = false;
+
+    terminal.pressKeys("echo lo");
+    remoteTerminal.pressKeys("echo re");
+    shell.executeIfInput();
+    remoteShell.executeIfInput();
+    assertEqual(terminal.getline(), "echo lo");
+    assertEqual(remoteTerminal.getline(), "echo re");
+
+    terminal.pressKeys("cal\r");
+    remoteTerminal.pressKeys("mote\r");
+    response = remoteShell.executeIfInput();
+    assertTrue(response);
+    assertEqual(remoteTerminal.getline(), "mote\r\nremote\r\n> ");
+    response = shell.executeIfInput();
+    assertTrue(response);
+    assertEqual(terminal.getline(), "cal\r\nlocal\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a hub shares each poll between sessions
+testF(ShellTest, hubRoundRobin) {
+
+    ShellHub hub;
+    hub.add(shell);
+    hub.add(remoteShell);
+    hub.setBudget(100000, 4);   // 4 chars per session per poll
+
+    terminal.pressKeys("echo one\r");
+    remoteTerminal.pressKeys("echo two\r");
+    assertEqual(hub.poll(), 0);
+    assertEqual(terminal.getline(), "echo");
+    assertEqual(remoteTerminal.getline(), "echo");
+
+    int commands = 0;
+    for (int polls = 0; polls < 3; polls++) {
+        commands += hub.poll();
+    }
+    assertEqual(commands, 2);
+    assertEqual(terminal.getline(), " one\r\none\r\n> ");
+    assertEqual(remoteTerminal.getline(), " two\r\ntwo\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a hub reports how long each session's input waited
+testF(ShellTest, hubLatency) {
+
+    ShellHub hub;
+    hub.add(shell);
+    hub.add(remoteShell);
+    hub.setBudget(100000, 16);
+    hub.setClock(fakeMicros);
+
+    // both wait from the start of the poll; the second also waits for the first
+    terminal.pressKeys("tick 300\r");
+    remoteTerminal.pressKeys("tick 300\r");
+    assertEqual(hub.poll(), 2);
+    assertEqual(hub.lastLatency(0), 300UL);
+    assertEqual(hub.lastLatency(1), 600UL);
+
+    terminal.pressKeys("tick 100\r");
+    remoteTerminal.pressKeys("tick 100\r");
+    assertEqual(hub.poll(), 2);
+    assertEqual(hub.maxLatency(0), 300UL);
+    assertEqual(hub.maxLatency(1), 600UL);
+    assertEqual(hub.averageLatency(0), 200UL);     // (300 + 100) / 2
+    assertEqual(hub.averageLatency(1), 400UL);     // (600 + 200) / 2
+
+    hub.resetLatency();
+    assertEqual(hub.maxLatency(1), 0UL);
+    assertEqual(hub.averageLatency(1), 0UL);
+    terminal.getline();
+    remoteTerminal.getline();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a task runs a step per executeIfInput() call
+testF(ShellTest, task) {
+
+    assertEqual(shell.execute("sum 1 2"), 3);
+    terminal.pressKeys("countdown 2\r");
+    assertTrue(shell.executeIfInput());
+    assertTrue(shell.taskRunning());
+    assertEqual(shell.lastErrNo(), 3);      // still the last finished
+    assertEqual(terminal.getline(), "countdown 2\r\n2\r\n");
+
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "1\r\n");
+
+    assertFalse(shell.executeIfInput());
+    assertFalse(shell.taskRunning());
+    assertEqual(shell.lastErrNo(), 0);
+    assertEqual(terminal.getline(), "> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  CTRL('C') cancels a task
+testF(ShellTest, cancelTask) {
+
+    terminal.pressKeys("countdown 9\r");
+    shell.executeIfInput();
+    String aLine = terminal.getline();  // flush output
+
+    terminal.pressKey(0x03);
+    assertFalse(shell.executeIfInput());
+    assertFalse(shell.taskRunning());
+    assertEqual(shell.lastErrNo(), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "stopped\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  the command is looked up as it's typed; editing it looks again
+testF(ShellTest, lookupWhileTyping) {
+
+    terminal.pressKeys("echx ");
+    assertFalse(shell.executeIfInput());
+    terminal.pressKeys("\b\bo aWord\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(shell.lastErrNo(), 0);
+    assertEqual(terminal.getline(), "echx \b \b\b \bo aWord\r\naWord\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  batch mode: no echo or prompt, several lines per call
+testF(ShellTest, batchMode) {
+
+    shell.setBatchMode(true);
+    terminal.pressKeys("echo one;echo two\n\nsum 1 2\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(shell.lastErrNo(), 3);
+    assertEqual(terminal.getline(), "one\r\ntwo\r\n");
+
+    terminal.pressKeys("batch off\r");
+    assertTrue(shell.executeIfInput());
+    assertFalse(shell.batchMode());
+    assertEqual(terminal.getline(), "> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  in batch mode, CTRL('C') behind other lines still cancels a task
+testF(ShellTest, batchCancelTask) {
+
+    shell.setBatchMode(true);
+    terminal.pressKeys("countdown 9\r");
+    assertTrue(shell.executeIfInput());
+    assertTrue(shell.taskRunning());
+    assertEqual(terminal.getline(), "9\r\n");
+
+    terminal.pressKeys("echo x\r");
+    terminal.pressKey(0x03);
+    assertFalse(shell.executeIfInput());
+    assertFalse(shell.taskRunning());
+    assertEqual(shell.lastErrNo(), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "stopped\r\n");
+    shell.setBatchMode(false);
+    assertEqual(terminal.getline(), "> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a framed request runs a command and gets a framed reply
+static uint8_t crc8(uint8_t crc, uint8_t b)
+{
+    crc ^= b;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+// types a request for "sum 2 3"
+static void pressSumFrame(void)
+{
+    uint8_t request[] = { SHELL_FRAME_SYN, 11, 0, 'l', 2, 0, 0, 0, 'l', 3, 0, 0, 0, 0 };
+    request[2] = SimpleSerialShell::commandId("sum");
+    for (int i = 1; i < 13; i++) {
+        request[13] = crc8(request[13], request[i]);
+    }
+    for (uint8_t b : request) {
+        terminal.pressKey(b);
+    }
+}
+
+testF(ShellTest, framedRequest) {
+
+    uint8_t id = SimpleSerialShell::commandId("sum");
+    uint8_t reply[] = { SHELL_FRAME_SYN, 6, id, SimpleSerialShell::FRAME_OK, 5, 0, 0, 0, 0 };
+    for (int i = 1; i < 8; i++) {
+        reply[8] = crc8(reply[8], reply[i]);
+    }
+
+    shell.setFrames(true);
+    pressSumFrame();
+    assertTrue(shell.executeIfInput());
+    shell.setFrames(false);
+    assertEqual(shell.lastErrNo(), 5);
+    for (uint8_t b : reply) {
+        assertEqual((uint8_t) terminal.getOutput(), b);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a frame that arrives while a task runs waits for it to finish
+testF(ShellTest, frameDuringTask) {
+
+    shell.setFrames(true);
+    terminal.pressKeys("countdown 2\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), "countdown 2\r\n2\r\n");
+
+    pressSumFrame();
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "1\r\n");
+    assertFalse(shell.executeIfInput());
+    assertFalse(shell.taskRunning());
+    assertEqual(terminal.getline(), "> ");
+
+    assertTrue(shell.executeIfInput());
+    shell.setFrames(false);
+    assertEqual(shell.lastErrNo(), 5);
+    assertEqual(terminal.getOutput(), SHELL_FRAME_SYN);
+    while (terminal.getOutput() >= 0)
+        ;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a framed task doesn't disturb a half-typed line
+testF(ShellTest, frameWhileTyping) {
+
+    terminal.pressKeys("echo half");
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "echo half");
+
+    // "countdown 1"
+    uint8_t request[] = { SHELL_FRAME_SYN, 6, 0, 'l', 1, 0, 0, 0, 0 };
+    request[2] = SimpleSerialShell::commandId("countdown");
+    for (int i = 1; i < 8; i++) {
+        request[8] = crc8(request[8], request[i]);
+    }
+    shell.setFrames(true);
+    for (uint8_t b : request) {
+        terminal.pressKey(b);
+    }
+    assertTrue(shell.executeIfInput());
+    while (shell.taskRunning()) {
+        shell.executeIfInput();
+    }
+    shell.setFrames(false);
+    assertEqual(shell.lastErrNo(), 0);
+    while (terminal.getOutput() >= 0)
+        ;
+
+    terminal.pressKeys(" line\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), " line\r\nhalf line\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a command run between the parts of a frame leaves it alone
+testF(ShellTest, frameSplitByExecute) {
+
+    uint8_t request[] = { SHELL_FRAME_SYN, 11, 0, 'l', 2, 0, 0, 0, 'l', 3, 0, 0, 0, 0 };
+    request[2] = SimpleSerialShell::commandId("sum");
+    for (int i = 1; i < 13; i++) {
+        request[13] = crc8(request[13], request[i]);
+    }
+    shell.setFrames(true);
+    for (int i = 0; i < 7; i++) {
+        terminal.pressKey(request[i]);
+    }
+    assertFalse(shell.executeIfInput());
+
+    // the expanded names are built in the arena too
+    SdFat sd;
+    FakeCard::files()["LOGFILE0.LOG"] = "";
+    FakeCard::files()["LOGFILE1.LOG"] = "";
+    shell.addSD(&sd);
+    assertEqual(shell.execute("nargs *.LOG"), 2);
+    shell.addSD(NULL);
+    FakeCard::files().clear();
+
+    for (int i = 7; i < 14; i++) {
+        terminal.pressKey(request[i]);
+    }
+    assertTrue(shell.executeIfInput());
+    shell.setFrames(false);
+    assertEqual(shell.lastErrNo(), 5);
+    assertEqual(terminal.getOutput(), SHELL_FRAME_SYN);
+    while (terminal.getOutput() >= 0)
+        ;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a GLOB_STREAM command walks any number of matches itself
+testF(ShellTest, streamingGlob) {
+
+    SdFat sd;
+    char name[16];
+    for (int i = 0; i < 50; i++) {
+        snprintf(name, sizeof(name), "LOG%02d.TXT", i);
+        FakeCard::files()[name] = "";
+    }
+    shell.addSD(&sd);
+    int response = shell.execute("countFiles *.TXT LOG1?.TXT");
+    shell.addSD(NULL);
+    FakeCard::files().clear();
+
+    assertEqual(response, 60);
+    assertEqual(terminal.getline(), "50\r\n10\r\n");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  the directory cache: read instead of the card, dropped after a write,
+//  and never refilled under an iterator that's walking it
+testF(ShellTest, globCache) {
+
+    static char cache[128];
+    SdFat sd;
+    FakeCard::files()["A.TXT"] = "";
+    FakeCard::files()["B.TXT"] = "";
+    FakeCard::files()["C.TXT"] = "";
+    shell.addSD(&sd);
+    SimpleSerialShell::setGlobCache(cache, sizeof(cache));
+
+    assertEqual(shell.execute("countFiles *.TXT"), 3);   // fills it
+    FakeCard::entriesRead() = 0;
+    assertEqual(shell.execute("countFiles *.TXT"), 3);
+    assertEqual(FakeCard::entriesRead(), 0UL);
+
+    assertEqual(shell.execute("fill 3 > D.TXT"), 3);
+    assertEqual(shell.execute("countFiles *.TXT"), 4);
+
+    {
+        SimpleSerialShell::GlobIterator first("*.TXT");
+        assertEqual(first.next(), "A.TXT");
+        FakeCard::files()["E.TXT"] = "";
+        SimpleSerialShell::invalidateGlobCache();
+        SimpleSerialShell::GlobIterator second("*.TXT");
+        int n = 0;
+        while (second.next()) {
+            n++;
+        }
+        assertEqual(n, 5);
+        assertEqual(first.next(), "B.TXT");
+        assertEqual(first.next(), "C.TXT");
+        assertEqual(first.next(), "D.TXT");
+        assertEqual(first.next(), (const char *) NULL);
+    }
+    assertEqual(shell.execute("countFiles *.TXT"), 5);
+
+    SimpleSerialShell::setGlobCache(NULL, 0);
+    shell.addSD(NULL);
+    FakeCard::files().clear();
+    assertEqual(terminal.getline(), "3\r\n3\r\n4\r\n5\r\n");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  glob matches go in the scratch arena; a command whose matches don't
+//  all fit isn't run
+testF(ShellTest, globScratch) {
+
+    SdFat sd;
+    char name[16];
+    for (int i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), "LOGFILE%d.LOG", i);
+        FakeCard::files()[name] = "";
+    }
+    shell.addSD(&sd);
+    unsigned misses = shell.scratchOverflows();
+    assertEqual(shell.execute("nargs *.LOG"), 3);
+    assertEqual(shell.scratchOverflows(), misses);
+    assertTrue(shell.scratchPeak() >= 3 * (13 + sizeof(char *)));
+
+    for (int i = 3; i < 9; i++) {
+        snprintf(name, sizeof(name), "LOGFILE%d.LOG", i);
+        FakeCard::files()[name] = "";
+    }
+    assertEqual(shell.execute("nargs *.LOG"), EXIT_FAILURE);
+    assertEqual(shell.scratchOverflows(), misses + 1);
+    assertTrue(shell.scratchPeak() <= SHELL_SCRATCH_SIZE);
+    shell.addSD(NULL);
+    FakeCard::files().clear();
+    assertEqual(terminal.getline(), "too many matches\r\n");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  output redirected to a file is written a sector at a time
+testF(ShellTest, bufferedRedirect) {
+
+    FakeCard::writes() = 0;
+    assertEqual(shell.execute("fill 1000 > OUT.TXT"), 1000);
+    assertEqual(FakeCard::writes(), 2UL);  // 512 + 488
+
+    // appending fills out the partly written sector first
+    FakeCard::writes() = 0;
+    assertEqual(shell.execute("fill 100 >> OUT.TXT"), 100);
+    assertEqual(shell.execute("fill 1000 >> OUT.TXT"), 1000);
+    assertEqual(FakeCard::writes(), 5UL);  // 24 + 76, then 436 + 512 + 52
+    assertEqual(FakeCard::files()["OUT.TXT"].size(), (size_t) 2100);
+
+    // '>' onto a file that's there starts it over
+    FakeCard::writes() = 0;
+    assertEqual(shell.execute("fill 10 > OUT.TXT"), 10);
+    assertEqual(FakeCard::writes(), 1UL);
+    assertEqual(FakeCard::files()["OUT.TXT"], std::string(10, 'x'));
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  one command's output goes to a file at a time; a failed write fails it
+testF(ShellTest, redirectConflicts) {
+
+    assertEqual(shell.execute("idle 3 > A.TXT &"), 0);
+    assertEqual(shell.execute("fill 5 > B.TXT"), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "[1]\r\noutput already redirected\r\n");
+    assertEqual(shell.execute("kill 1"), 0);
+    assertEqual(terminal.getline(), "done\r\n");
+    assertEqual(shell.execute("fill 5 > B.TXT"), 5);
+    assertEqual(FakeCard::files()["B.TXT"], std::string(5, 'x'));
+
+    FakeCard::full() = true;
+    assertEqual(shell.execute("fill 5 > C.TXT"), EXIT_FAILURE);
+    FakeCard::full() = false;
+    assertEqual(terminal.getline(), "output not all written\r\n");
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a command reads the file after '<'
+testF(ShellTest, inputRedirect) {
+
+    std::string log;
+    for (int i = 0; i < 100; i++) {
+        log += "reading 42\n";     // more than a block
+    }
+    FakeCard::files()["LOG.TXT"] = log;
+    assertEqual(shell.execute("countLines < LOG.TXT"), 100);
+    assertEqual(shell.execute("countLines < NONE.TXT"), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "NONE.TXT: can't open\r\n");
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  "source" runs the lines of a file, unechoed
+testF(ShellTest, sourceScript) {
+
+    FakeCard::files()["SETUP.SH"] = "# comment\necho one; echo two\n\nsum 2 3";
+    terminal.pressKeys("source SETUP.SH\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), "source SETUP.SH\r\n");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), "one\r\ntwo\r\n> ");
+    assertEqual(shell.lastErrNo(), 5);
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a script the sketch starts leaves a half-typed line alone
+testF(ShellTest, scriptWhileTyping) {
+
+    FakeCard::files()["SETUP.SH"] = "echo one\nsum 2 3";
+    terminal.pressKeys("echo typed");
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "echo typed");
+
+    assertEqual(shell.execute("source SETUP.SH"), 0);
+    assertTrue(shell.executeIfInput());
+    assertFalse(shell.busy());
+    assertEqual(terminal.getline(), "one\r\n");
+
+    terminal.pressKeys(" line\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), " line\r\ntyped line\r\n> ");
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  CTRL('C') stops a script, even behind other typing
+testF(ShellTest, stopScript) {
+
+    FakeCard::files()["SETUP.SH"] = "echo one\necho two\n";
+    assertEqual(shell.execute("source SETUP.SH"), 0);
+    terminal.pressKeys("xy");
+    terminal.pressKey(0x03);
+    assertFalse(shell.executeIfInput());
+    assertFalse(shell.busy());
+    assertEqual(terminal.getline(), "stopped\r\n");
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a hub keeps a script going with no input waiting
+testF(ShellTest, hubRunsScript) {
+
+    ShellHub hub;
+    hub.add(shell);
+    hub.add(remoteShell);
+    hub.setBudget(100000, 4);
+
+    FakeCard::files()["SETUP.SH"] = "echo one; echo two\nsum 2 3";
+    terminal.pressKeys("source SETUP.SH\r");
+    for (int polls = 0; polls < 20; polls++) {
+        hub.poll();
+    }
+    assertFalse(shell.busy());
+    assertEqual(terminal.getline(), "source SETUP.SH\r\none\r\ntwo\r\n> ");
+    assertEqual(shell.lastErrNo(), 5);
+    FakeCard::files().clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  "a | b" feeds a's output to b a turn at a time
+testF(ShellTest, pipeline) {
+
+    // 50 lines is more than the pipe holds at once
+    assertEqual(shell.execute("countdown 50 | countLines"), 50);
+    assertEqual(shell.execute("echo a b | countLines"), 1);
+    assertEqual(terminal.getline(), "");
+
+    // a plain command writes all at once; what doesn't fit fails the pipeline
+    assertEqual(shell.execute("help | countLines"), EXIT_FAILURE);
+    assertEqual(shell.lastErrNo(), EXIT_FAILURE);
+    assertTrue(terminal.getline().endsWith(" bytes lost (pipe full)\r\n"));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a task reading a pipe waits its turn while the writer has nothing
+testF(ShellTest, pipeToTask) {
+
+    terminal.pressKeys("idle 3 | tally\r");
+    assertTrue(shell.executeIfInput());
+    assertTrue(shell.taskRunning());
+    for (int turns = 0; turns < 10 && shell.taskRunning(); turns++) {
+        shell.executeIfInput();
+    }
+    assertFalse(shell.taskRunning());
+    assertEqual(shell.lastErrNo(), 1);
+    assertEqual(terminal.getline(), "idle 3 | tally\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a plain command filling a pipe gives the task reading it a step
+testF(ShellTest, pipePushesToTask) {
+
+    Capture help;
+    shell.attach(help);
+    shell.execute("help");
+    shell.attach(terminal);
+    int lines = 0;
+    for (unsigned i = 0; i < help.text.length(); i++) {
+        lines += help.text[i] == '\n';
+    }
+    assertTrue(help.text.length() > SHELL_PIPE_SIZE);
+
+    assertEqual(shell.execute("help | tally"), lines);
+    assertFalse(shell.taskRunning());
+    assertEqual(terminal.getline(), "");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  a reader doesn't wait forever for a writer that writes nothing
+testF(ShellTest, pipeStalls) {
+
+    assertEqual(shell.execute("idle 5000 | countLines"), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "pipe stalled\r\n");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  "&" runs a task in the background
+testF(ShellTest, backgroundJob) {
+
+    terminal.pressKeys("countdown 2 &\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), "countdown 2 &\r\n[1]\r\n> ");
+
+    terminal.pressKeys("jobs\r");
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), "2\r\njobs\r\n[1] countdown 2 &\r\n> ");
+
+    shell.executeIfInput();
+    assertEqual(terminal.getline(), "1\r\n");
+    shell.executeIfInput();
+    assertEqual(terminal.getline(), "[1] done\r\n");
+    assertFalse(shell.taskRunning());
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// with an ANSI terminal, an edit mid-line sends a few bytes, not the line
+testF(ShellTest, ansiRedraw) {
+
+    shell.setAnsi(true);
+    terminal.pressKeys("echo hllo world");
+    shell.executeIfInput();
+    assertEqual(terminal.getline(), "echo hllo world");
+
+    for (int i = 0; i < 9; i++) {
+        terminal.pressKey(0x02);    // CTRL('B') back to the 'l'
+    }
+    shell.executeIfInput();
+    assertEqual(terminal.getline(), "\b\b\b\b\b\b\b\b\b");
+
+    terminal.pressKey('e');
+    shell.executeIfInput();
+    assertEqual(terminal.getline(), "\x1b[1@e");
+
+    terminal.pressKey(0x04);        // CTRL('D') deletes the 'l'
+    shell.executeIfInput();
+    assertEqual(terminal.getline(), "\x1b[1P");
+
+    terminal.pressKey('\r');
+    assertTrue(shell.executeIfInput());
+    shell.setAnsi(false);
+    assertEqual(terminal.getline(), "\r\nhelo world\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// history keeps the newest lines that fit in HIST_BYTES, dropping the oldest
+testF(ShellTest, historyWraps) {
+
+    char line[16];
+    for (int i = 0; i < 30; i++) {
+        snprintf(line, sizeof(line), "echo %02d\r", i);
+        terminal.pressKeys(line);
+        assertTrue(shell.executeIfInput());
+        terminal.getline();
+    }
+
+    // each line takes its length + 2 bytes: 256 hold the newest 28
+    for (int i = 0; i < 28; i++) {
+        terminal.pressKey(0x10);    // CTRL('P')
+        assertFalse(shell.executeIfInput());
+        terminal.getline();
+    }
+    terminal.pressKey(0x10);        // nothing older
+    assertFalse(shell.executeIfInput());
+    assertEqual(terminal.getline(), "\x07");
+
+    terminal.pressKey('\r');
+    assertTrue(shell.executeIfInput());
+    assertEqual(terminal.getline(), "\r\n02\r\n> ");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  "kill n" cancels a background job; "fg" brings one to the foreground
+testF(ShellTest, fgAndKill) {
+
+    assertEqual(shell.execute("countdown 5 &"), 0);
+    assertEqual(shell.execute("kill 1"), 0);
+    assertFalse(shell.taskRunning());
+    assertEqual(shell.execute("kill 1"), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "[1]\r\nstopped\r\nno such job\r\n");
+
+    assertEqual(shell.execute("countdown 2 &"), 0);
+    assertEqual(shell.execute("fg"), 0);
+    assertEqual(shell.execute("echo not yet"), EXIT_FAILURE);
+    assertEqual(terminal.getline(), "[1]\r\nbusy\r\n");
+
+    shell.executeIfInput();
+    shell.executeIfInput();
+    assertTrue(shell.taskRunning());
+    shell.executeIfInput();
+    assertFalse(shell.taskRunning());
+    assertEqual(shell.lastErrNo(), 0);
+    assertEqual(terminal.getline(), "2\r\n1\r\n");    // fg came from the sketch: no prompt
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // shell backspace from stream works?
 testF(ShellTest, backspace) {
@@ -211,7 +1060,7 @@ testF(ShellTest, backspace) {
     errNo = shell.lastErrNo();
     assertEqual(errNo, 0);    // OK or no errors
 
-    assertEqual(terminal.getline(), "\r\nhello world\r\n");
+    assertEqual(terminal.getline(), "\r\nhello world\r\n> ");
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -246,7 +1095,7 @@ testF(ShellTest, delete) {
     errNo = shell.lastErrNo();
     assertEqual(errNo, 0);    // OK or no errors
 
-    assertEqual(terminal.getline(), "\r\nhello world\r\n");
+    assertEqual(terminal.getline(), "\r\nhello world\r\n> ");
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -265,7 +1114,8 @@ void setup() {
     while (!Serial); // for the Arduino Leonardo/Micro only
     showID();
     shell.attach(terminal);
-    shell.addCommand(F("id?"), showID);
+    remoteShell.attach(remoteTerminal);
+    shell.addCommand(F("id?"), showID, false, false, NULL);
 
     addTestCommands();
 }
@@ -0,0 +1,112 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include "ShellHub.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @file ShellHub.cpp
+ *
+ *  Round robin poller for several shell sessions.
+ *
+ */
+
+ShellHub::ShellHub(void)
+    : count(0), next(0), budgetMicros(1000), budgetChars(16), clock(micros)
+{
+}
+
+bool ShellHub::add(SimpleSerialShell & s)
+{
+    if (count >= SHELLHUB_MAX_SESSIONS) {
+        return false;
+    }
+    session[count].shell = &s;
+    session[count].waiting = false;
+    session[count].last = session[count].worst = 0;
+    session[count].total = session[count].waits = 0;
+    count++;
+    return true;
+}
+
+void ShellHub::setBudget(unsigned long usec, int chars)
+{
+    budgetMicros = usec;
+    budgetChars = chars;
+}
+
+void ShellHub::setClock(unsigned long (*usec)(void))
+{
+    clock = usec ? usec : micros;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int ShellHub::poll(void)
+{
+    unsigned long start = clock();
+    int commands = 0;
+
+    // note who has input waiting, so latency counts time spent in line
+    for (int i = 0; i < count; i++) {
+        if (!session[i].waiting && session[i].shell->available() > 0) {
+            session[i].waiting = true;
+            session[i].waitingSince = start;
+        }
+    }
+
+    for (int visited = 0; visited < count; visited++) {
+        if (visited > 0 && clock() - start >= budgetMicros) {
+            break;
+        }
+        Session & s = session[next];
+        next = (next + 1) % count;
+
+        if (!s.waiting && !s.shell->busy()) {
+            continue;
+        }
+        if (s.shell->executeIfInput(budgetChars)) {
+            commands++;
+        }
+        unsigned long now = clock();
+        if (s.waiting) {
+            s.last = now - s.waitingSince;
+            if (s.last > s.worst) {
+                s.worst = s.last;
+            }
+            s.total += s.last;
+            s.waits++;
+        }
+        // what's left over has been waiting since now
+        s.waiting = s.shell->available() > 0;
+        s.waitingSince = now;
+    }
+    return commands;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int ShellHub::sessions(void) const
+{
+    return count;
+}
+
+unsigned long ShellHub::lastLatency(int i) const
+{
+    return (i >= 0 && i < count) ? session[i].last : 0;
+}
+
+unsigned long ShellHub::maxLatency(int i) const
+{
+    return (i >= 0 && i < count) ? session[i].worst : 0;
+}
+
+unsigned long ShellHub::averageLatency(int i) const
+{
+    return (i >= 0 && i < count && session[i].waits) ? session[i].total / session[i].waits : 0;
+}
+
+void ShellHub::resetLatency(void)
+{
+    for (int i = 0; i < count; i++) {
+        session[i].last = session[i].worst = 0;
+        session[i].total = session[i].waits = 0;
+    }
+}
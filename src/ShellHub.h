@@ -0,0 +1,74 @@
+
+#ifndef SHELL_HUB_H
+#define SHELL_HUB_H
+
+#include "SimpleSerialShell.h"
+
+#if !defined(SHELLHUB_MAX_SESSIONS)
+#define SHELLHUB_MAX_SESSIONS 4
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @file ShellHub.h
+ *
+ *  Services several shell sessions (one per stream) fairly from loop().
+ *
+ *  Each poll() visits the sessions round robin, starting after the one
+ *  visited last, reads at most 'chars' characters from each and stops
+ *  once 'usec' microseconds have gone by.  A burst on one port can't starve the
+ *  others or the rest of the sketch; a poll takes at most the time
+ *  budget plus one session's turn.  (A command that runs long still
+ *  runs to completion; make it a task to spread it over several polls.)
+ *  A session running a task gets a turn on every poll.
+ *
+ *      SizedSerialShell<> remote;
+ *      ShellHub hub;
+ *      ...
+ *      hub.add(shell);
+ *      hub.add(remote);
+ *      hub.setBudget(2000, 16);    // 2 ms per poll, 16 chars per turn
+ *      ...
+ *      hub.poll();                 // in loop()
+ */
+class ShellHub {
+    public:
+        ShellHub(void);
+
+        // false when there are already SHELLHUB_MAX_SESSIONS
+        bool add(SimpleSerialShell & session);
+        void setBudget(unsigned long usec, int chars);
+        // where the time comes from (micros() unless set), e.g. a
+        // fake clock for tests
+        void setClock(unsigned long (*usec)(void));
+
+        // returns the number of commands run
+        int poll(void);
+
+        int sessions(void) const;
+        // input latency in microseconds: from when poll() first saw
+        // input waiting for session i until that session was serviced
+        unsigned long lastLatency(int i) const;
+        unsigned long maxLatency(int i) const;
+        unsigned long averageLatency(int i) const;
+        void resetLatency(void);
+
+    private:
+        struct Session {
+            SimpleSerialShell * shell;
+            unsigned long waitingSince;
+            bool waiting;
+            unsigned long last;
+            unsigned long worst;
+            unsigned long total;    // of the waits since resetLatency()
+            unsigned long waits;
+        };
+        Session session[SHELLHUB_MAX_SESSIONS];
+        int count;
+        int next;       // visited first by the next poll()
+        unsigned long budgetMicros;
+        int budgetChars;
+        unsigned long (*clock)(void);
+};
+
+#endif /* SHELL_HUB_H */
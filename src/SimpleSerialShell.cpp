@@ -14,10 +14,40 @@
  */
 
 
-SimpleSerialShell shell;
+static SizedSerialShell<> defaultShell;
+SimpleSerialShell & shell = defaultShell;
 
 //
+SimpleSerialShell * SimpleSerialShell::running = NULL;
 SimpleSerialShell::Command * SimpleSerialShell::firstCommand = NULL;
+SimpleSerialShell::Command ** SimpleSerialShell::commandIndex = NULL;
+int SimpleSerialShell::numCommands = 0;
+bool SimpleSerialShell::indexStale = false;
+SimpleSerialShell::CommandTable * SimpleSerialShell::firstTable = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+// Case insensitive comparison of a command name kept in flash (PROGMEM)
+// against another name.  Reads flash a byte at a time rather than copying
+// the name into a String, so comparisons never touch the heap.
+// 'other' is in RAM unless otherInFlash (when sorting two command names).
+//
+static int flashNameCompare(PGM_P p, PGM_P other, bool otherInFlash)
+{
+
+#if defined(__AVR__)
+    if (!otherInFlash) {
+        return -strcasecmp_P(other, p);
+    }
+#endif
+
+    for (;; p++, other++) {
+        int a = tolower(pgm_read_byte(p));
+        int b = tolower(otherInFlash ? pgm_read_byte(other) : (unsigned char) *other);
+        if (a != b || a == '\0') {
+            return a - b;
+        }
+    }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 /*!
@@ -25,8 +55,9 @@ SimpleSerialShell::Command * SimpleSerialShell::firstCommand = NULL;
  */
 class SimpleSerialShell::Command {
     public:
-        Command(const __FlashStringHelper * n, CommandFunction f, boolean g, boolean e, const __FlashStringHelper *u):
-            name(n), myFunc(f), glob(g), expand(e), usage(u) {};
+        Command(const __FlashStringHelper * n, CommandFunction f, uint8_t g, boolean e, const __FlashStringHelper *u,
+                TaskFunction t = NULL):
+            name(n), myFunc(f), glob(g), expand(e), usage(u), task(t) {};
 
         int execute(int argc, char **argv)
         {
@@ -36,30 +67,107 @@ class SimpleSerialShell::Command {
         // to sort commands
         int compare(const Command * other) const
         {
-            const String otherNameString(other->name);
-            return compareName(otherNameString.c_str());
+            return flashNameCompare((PGM_P) name, (PGM_P) other->name, true);
         };
 
         int compareName(const char * aName) const
         {
-            const String myNameString(name);
-            int comparison = strncasecmp(myNameString.c_str(), aName, BUFSIZE);
-            return comparison;
+            return flashNameCompare((PGM_P) name, aName, false);
+        };
+
+        void getEntry(CommandEntry & entry) const
+        {
+            entry.name = (PGM_P) name;
+            entry.func = myFunc;
+            entry.glob = glob;
+            entry.expand = expand;
+            entry.usage = (PGM_P) usage;
+            entry.task = task;
         };
 
         const __FlashStringHelper * name;
         CommandFunction myFunc;
         Command * next;
-        boolean glob;
+        uint8_t glob;
         boolean expand;
         const __FlashStringHelper *usage;
+        TaskFunction task;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @brief a sorted table of CommandEntry's in flash, see addCommands().
+ */
+struct SimpleSerialShell::CommandTable {
+    const CommandEntry * entries;
+    size_t count;
+    size_t cursor;  // used by printHelp() to merge tables in order
+    CommandTable * next;
+
+    void getEntry(size_t i, CommandEntry & entry) const
+    {
+        memcpy_P(&entry, &entries[i], sizeof(entry));
+    };
+
+    // binary search; entries are unique
+    bool find(const char * aName, CommandEntry & found) const
+    {
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            getEntry(mid, found);
+            int comparison = flashNameCompare(found.name, aName, false);
+            if (comparison < 0) {
+                lo = mid + 1;
+            }
+            else if (comparison > 0) {
+                hi = mid;
+            }
+            else {
+                return true;
+            }
+        }
+        return false;
+    };
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-SimpleSerialShell::SimpleSerialShell()
+SimpleSerialShell::SimpleSerialShell(char * line, size_t lineSize, char ** argv, int maxArgs)
     : shellConnection(NULL),
-      m_lastErrNo(EXIT_SUCCESS)
+      m_lastErrNo(EXIT_SUCCESS),
+      task(NULL),
+      scratchUsed(0),
+      scratchTop(SHELL_SCRATCH_SIZE),
+      scratchMax(0),
+      scratchMisses(0),
+      batch(false),
+      discarding(false),
+      script(NULL),
+      scriptLine(NULL),
+      input(NULL),
+      output(NULL),
+      pending(NULL),
+      reading(NULL),
+      frames(false),
+      frameGot(-1),
+      frameTime(0),
+      numbers(NULL),
+      numberCount(0),
+      lineTaken(true),
+      scanned(0),
+      firstWord(-1),
+      early(UNSEEN),
+      linebuffer(line),
+      lineSize(lineSize),
+      cmdLine(line),
+      cmdSize(0),
+      args(argv),
+      maxArgs(maxArgs)
 {
+    static bool haveHelp = false;
+
+    memset(jobs, 0, sizeof(jobs));
     resetBuffer();
     addFallback(NULL);
     addStrings(NULL);
@@ -67,432 +175,2525 @@ SimpleSerialShell::SimpleSerialShell()
     addRedirector(NULL);
     addSD(NULL);
 
-    // simple help.
-    addCommand(F("help"), SimpleSerialShell::printHelp, false, false, NULL);
+    // the editor works right in linebuffer, and commands run from there
+    rl_init(&editor);
+    editor.Line = (unsigned char *) linebuffer;
+    editor.Length = lineSize;
+    editor.FixedLine = 1;
+    editor.User = this;
+    editor.Waiting = editorWaiting;
+    editor.Get = editorGet;
+    editor.Put = editorPut;
+    editor.Complete = editorComplete;
+    editor.List = editorList;
+
+    // simple help and job control, shared by every session.
+    if (!haveHelp) {
+        haveHelp = true;
+        addCommand(F("help"), SimpleSerialShell::printHelp, false, false, NULL);
+        addCommand(F("jobs"), SimpleSerialShell::jobsCommand, false, false, NULL);
+        addCommand(F("fg"), SimpleSerialShell::fgCommand, false, false, F("[n]"));
+        addCommand(F("kill"), SimpleSerialShell::killCommand, false, false, F("n"));
+        addCommand(F("batch"), SimpleSerialShell::batchCommand, false, false, F("on|off"));
+        addCommand(F("source"), SimpleSerialShell::sourceCommand, false, false, F("file"));
+    }
 };
 
-char **SimpleSerialShell::glob(SdFat *sd, char *spec, int *n)
+SimpleSerialShell::~SimpleSerialShell(void)
 {
-    SdFile root;
-    SdFile entry;
-    char   buff[16];
-    int n_match = 0;
-    char **matches = NULL;
-
-    *n = 0;
-    if (!sd) 
-        return NULL;
-        
-    sd -> vol()->cwd(buff, 16);
-    
-    if (!root.open(buff)) {
-        return NULL;
-    }    
-
-    while (entry.openNext(&root, O_RDONLY)) {   
-        entry.getName(buff, 16);  
-
-        if (fnmatch(spec, buff, 0) == 0) {
-            matches = (char **) realloc(matches, sizeof(char *)*(n_match + 1));
-            matches[n_match ++] = strndup(buff, 16);
-        }
-        entry.close();
-    }
-    root.close();
-
-    *n = n_match;
-    return matches;
+    rl_free(&editor);
 }
+
 //////////////////////////////////////////////////////////////////////////////
-void SimpleSerialShell::addCommand(
-    const __FlashStringHelper * name, CommandFunction f, boolean g, boolean e, const __FlashStringHelper *u)
+// The line editor talks to the stream this session is attached to.
+//
+int SimpleSerialShell::editorWaiting(void * user)
 {
-    auto * newCmd = new Command(name, f, g, e, u);
-
-    // insert in list alphabetically
-    // from stackoverflow...
-
-    Command* temp2 = firstCommand;
-    Command** temp3 = &firstCommand;
-    while (temp2 != NULL && (newCmd->compare(temp2) > 0) )
-    {
-        temp3 = &temp2->next;
-        temp2 = temp2->next;
+    SimpleSerialShell * me = (SimpleSerialShell *) user;
+    Stream * s = me->shellConnection;
+    if (me->frameWaiting()) {
+        return 0;   // leave the frame for executeIfInput()
     }
-    *temp3 = newCmd;
-    newCmd->next = temp2;
+    return s ? s->available() : 0;
 }
 
-void SimpleSerialShell::addFallback(int (*fb)(int argc, char **argv))
+int SimpleSerialShell::editorGet(void * user)
 {
-    fallback = fb;
+    Stream * s = ((SimpleSerialShell *) user)->shellConnection;
+    return s ? s->read() : -1;
 }
 
-void SimpleSerialShell::addStrings(char *(*s)(char *argv))
+void SimpleSerialShell::editorPut(void * user, const char * buf, size_t len)
 {
-    stringExpand = s;
+    Stream * s = ((SimpleSerialShell *) user)->shellConnection;
+    if (s) {
+        s->write((const uint8_t *) buf, len);
+    }
 }
 
-void SimpleSerialShell::addFloats(float (*s)(char *argv))
+int SimpleSerialShell::editorComplete(void * user, const char * line, int start, int end, char * buf, int size)
 {
-    floatExpand = s;
+    return ((SimpleSerialShell *) user)->complete(line, start, end, buf, size);
 }
 
-void SimpleSerialShell::addRedirector(Stream *(*f)(Stream *c, SdFile *f))
+void SimpleSerialShell::editorList(void * user, const char * line, int start, int end)
 {
-    consoleChange = f;
+    ((SimpleSerialShell *) user)->listCompletions(line, start, end);
 }
 
-void SimpleSerialShell::addSD(SdFat *s)
-{
-    sd = s;
-}
 //////////////////////////////////////////////////////////////////////////////
-bool SimpleSerialShell::executeIfInput(void)
+// The names in a directory, kept by setGlobCache() in storage lent by the
+// sketch: the directory's name, then each file name, all NUL terminated.
+// It isn't refilled while an iterator is reading or filling it.
+//
+static struct {
+    char * names;
+    size_t size;
+    size_t used;
+    bool valid;     // holds the whole directory
+    int readers;    // iterators using it
+    unsigned changes;   // invalidations, so a walk under way isn't trusted
+} dirCache;
+
+void SimpleSerialShell::setGlobCache(char * buffer, size_t size)
 {
-    bool didSomething = false;
-    char *line;
-
-    line = readline();
-    if (line) {
-        didSomething = true;
-        strcpy(linebuffer, line);
-        execute();
-        add_history(line);
-        resetline("> ");
-    }
-
-    /*
-    bool bufferReady = prepInput();
-    bool didSomething = false;
-
-    if (bufferReady) {
-        didSomething = true;
-        execute();
-    }
+    dirCache.names = buffer;
+    dirCache.size = size;
+    dirCache.used = 0;
+    dirCache.valid = false;
+}
 
-    return didSomething;
-    */
+void SimpleSerialShell::invalidateGlobCache(void)
+{
+    dirCache.valid = false;
+    dirCache.changes++;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-void SimpleSerialShell::attach(Stream & requester)
+static bool remember(const char * name)
 {
-    shellConnection = &requester;
-    resetline("> ");
+    size_t len = strlen(name) + 1;
+
+    if (dirCache.used + len > dirCache.size) {
+        return false;
+    }
+    memcpy(dirCache.names + dirCache.used, name, len);
+    dirCache.used += len;
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-// Arduino serial monitor appears to 'cook' lines before sending them
-// to output, so some of this is overkill.
+// Reads the cache when it holds the current directory, otherwise the
+// card, filling the cache on the way (it's whole once the walk ends)
+// unless another iterator is still using it.
 //
-// But for serial terminals, backspace would be useful.
-//
-bool SimpleSerialShell::prepInput(void)
+SimpleSerialShell::GlobIterator::GlobIterator(const char * aSpec, SdFat * sd)
+    : spec(aSpec), cached(NULL), filling(false), reader(false), changes(0)
 {
-    bool bufferReady = false; // assume not ready
-    bool moreData = true;
-
-    do {
-        int c = read();
-        switch (c)
-        {
-            case -1: // No character present; don't do anything.
-                moreData = false;
-                break;
-            case  0: // throw away NUL characters
-                break;
-
-            // Line editing characters
-            case 127: // DEL delete key
-            case '\b':  // CTRL(H) backspace
-                // Destructive backspace: remove last character
-                if (inptr > 0) {
-                    print("\b \b");  // remove char in raw UI
-                    linebuffer[--inptr] = 0;
-                }
-                break;
-
-            case 0x12: //CTRL('R')
-                //Ctrl-R retypes the line
-                print("\r\n");
-                print(linebuffer);
-                break;
-
-            case 0x15: //CTRL('U')
-                //Ctrl-U deletes the entire line and starts over.
-                println("XXX");
-                resetBuffer();
-                break;
-
-            case ';':   // BLE monitor apps don't let you add '\r' to a string,
-            // so ';' ends a command
-
-            case '\r':  //CTRL('M') carriage return (or "Enter" key)
-                // raw input only sends "return" for the keypress
-                // line is complete
-                println();     // Echo newline too.
-                bufferReady = true;
-                break;
-
-            case '\n':  //CTRL('J') linefeed
-                // ignore newline as 'raw' terminals may not send it.
-                // Serial Monitor sends a "\r\n" pair by default
-                break;
-
-            default:
-                // Otherwise, echo the character and append it to the buffer
-                linebuffer[inptr++] = c;
-                write(c);
-                if (inptr >= BUFSIZE-1) {
-                    bufferReady = true; // flush to avoid overflow
-                }
-                break;
-        }
-    } while (moreData && !bufferReady);
+    if (sd == NULL) {
+        sd = (running ? running : &shell)->sd;
+    }
+    if (!sd) {
+        return;
+    }
+    sd -> vol()->cwd(name, sizeof(name));
 
-    return bufferReady;
+    if (dirCache.valid && strcmp(dirCache.names, name) == 0) {
+        cached = dirCache.names + strlen(name) + 1;
+        reader = true;
+        dirCache.readers++;
+        return;
+    }
+    if (!root.open(name)) {
+        return;
+    }
+    if (dirCache.readers > 0) {
+        return;     // someone's walking it; just read the card
+    }
+    dirCache.valid = false;
+    dirCache.used = 0;
+    filling = dirCache.names && remember(name);
+    if (filling) {
+        reader = true;
+        dirCache.readers++;
+        changes = dirCache.changes;
+    }
 }
 
-//////////////////////////////////////////////////////////////////////////////
-int SimpleSerialShell::execute(const char commandString[])
+SimpleSerialShell::GlobIterator::~GlobIterator(void)
 {
-    // overwrites anything in linebuffer; hope you don't need it!
-    strncpy(linebuffer, commandString, BUFSIZE);
-    return execute();
+    if (root.isOpen()) {
+        root.close();
+    }
+    if (reader) {
+        dirCache.readers--;
+    }
 }
 
-int SimpleSerialShell::split(char *buffer, char **argv, int max_argv)
+const char * SimpleSerialShell::GlobIterator::next(void)
 {
-    char *p, *start_of_word;
-    int c;
-    enum states { REGULAR, IN_WORD, IN_STRING } state = REGULAR;
-    int argc = 0;
-
-    for (p = buffer; argc < max_argv && *p != '\0'; p++) {
-        c = (unsigned char) *p;
-        switch (state) {
-        case REGULAR:
-            if (isspace(c)) {
-                continue;
-            }
+    SdFile entry;
+    const char * found;
 
-            if (c == '"') {
-                state = IN_STRING;
-                start_of_word = p + 1;
-                continue;
+    for (;;) {
+        if (cached) {
+            if (cached >= dirCache.names + dirCache.used) {
+                cached = NULL;
+                return NULL;
             }
-            state = IN_WORD;
-            start_of_word = p;
-            continue;
-
-        case IN_STRING:
-            if (c == '"') {
-                *p = 0;
-                argv[argc++] = start_of_word;
-                state = REGULAR;
+            found = cached;
+            cached += strlen(cached) + 1;
+        }
+        else {
+            if (!root.isOpen()) {
+                return NULL;
             }
-            continue;
-
-        case IN_WORD:
-            if (isspace(c)) {
-                *p = 0;
-                argv[argc++] = start_of_word;
-                state = REGULAR;
+            if (!entry.openNext(&root, O_RDONLY)) {
+                root.close();
+                if (filling) {
+                    dirCache.valid = changes == dirCache.changes;
+                    filling = false;
+                }
+                return NULL;
             }
-            continue;
+            entry.getName(name, sizeof(name));
+            entry.close();
+            filling = filling && remember(name);
+            found = name;
+        }
+        if (spec == NULL || fnmatch(spec, found, 0) == 0) {
+            return found;
         }
     }
-
-    if (state != REGULAR && argc < max_argv)
-        argv[argc++] = start_of_word;
-
-    return argc;
-
 }
+
 //////////////////////////////////////////////////////////////////////////////
-int SimpleSerialShell::execute(void)
+// File names matching spec in the current directory.  The names and the
+// array live in the scratch arena until the command finishes (don't free
+// them); if the arena fills up, the later matches are left out.
+// The names are packed from the bottom of the arena and the pointers
+// from the top, so both grow a match at a time.  The directory is read
+// from the cache when it can be (see setGlobCache()).
+//
+char **SimpleSerialShell::glob(SdFat *sd, char *spec, int *n)
 {
-    char * argv[MAXARGS] = {0};
-    int argc = 0;
-    char *raw_argv[MAXARGS] = {0};
-    int raw_argc = 0;
-    char *ptr;
-    float f;
-    SdFile redir;
-    Stream *consoleSave = NULL;
-    boolean redirOk = false;
-    boolean append;
+    const char *buff;
+    int n_match = 0;
     char **matches = NULL;
-    int    n_matches = 0;
-    char * catName;
-    Command *aCmd = NULL;
-    char **floats = NULL;
-    int    i, j, nfloats = 0;
-    char  *anArg;
-
-    linebuffer[BUFSIZE - 1] = '\0'; // play it safe
-
-    raw_argc = split(linebuffer, raw_argv, MAXARGS);
+    char  *name;
+    char **slot;
 
-    if (raw_argc == 0)
-    {
-        // empty line; no arguments found.
-        println(F("OK"));
-        resetBuffer();
-        return EXIT_SUCCESS;
-    }
-    argv[argc++] = raw_argv[0];
+    *n = 0;
+    if (!sd) 
+        return NULL;
 
-    m_lastErrNo = 0;
-    for ( aCmd = firstCommand; aCmd != NULL; aCmd = aCmd->next) {
-        if (aCmd->compareName(argv[0]) == 0) {
+    GlobIterator files(spec, sd);
+    while ((buff = files.next()) != NULL) {
+        if ((name = (char *) scratch(strlen(buff) + 1, 1)) == NULL ||
+            (slot = (char **) scratch(sizeof(char *), sizeof(char *), true)) == NULL) {
+            // full; carry on only to fill the cache
+            files.spec = NULL;
+            while (files.filling && files.next())
+                ;
             break;
         }
+        strcpy(name, buff);
+        *slot = name;
+        matches = slot;
+        n_match++;
     }
 
-    // TODO: handle quoted args, glob (fnmatch), variable expansion, redirection
-    for (j = 1 ; j < raw_argc && argc < MAXARGS ; j++)
-    {
-        anArg = raw_argv[j];
-        if (aCmd && aCmd -> glob && (strchr(anArg, '*') || strchr(anArg, '?'))) {
-            matches = glob(sd, anArg, &n_matches);
-            for (i = 0 ; i < n_matches && argc < MAXARGS ; i++) {
-                argv[argc++] = matches[i];
-            }    
-        }
-        else if (anArg[0] == '>' && j < raw_argc - 1) {
-            append = strstr(anArg, ">>") ? true : false;
-            catName = raw_argv[++ j];
-            redirOk = redir.open(catName, append ? O_WRITE | O_CREAT | O_AT_END : O_WRITE | O_CREAT);
-        }
-        else if (aCmd && aCmd -> expand && anArg[0] == '_' && floatExpand) {
-            f = floatExpand(anArg + 1);
-            if (f == NAN) {
-                argv[argc++] = NULL; // or empty string?
-            }
-            else {
-                floats = (char **) realloc(floats, sizeof(char *)*(nfloats + 1));
-                floats[nfloats] = (char *) malloc(sizeof(char) * 12);
-                snprintf(floats[nfloats], 10, "%f", f);
-                argv[argc++] = floats[nfloats];
-                nfloats ++;
-            }    
-        }
-        else if (aCmd && aCmd -> expand && anArg[0] == '$' && stringExpand) {
-            if ((ptr = stringExpand(anArg + 1)) != NULL)
-                argv[argc++] = ptr;
-            else
-                argv[argc++] = NULL; // or empty string??
-        }
-        else if (anArg) {
-            argv[argc++] = anArg;
-        } 
-        else {
-            println("uh oh");
-            // uh oh?
-        }
+    // the pointers went in downwards; put them in directory order
+    for (int i = 0; i < n_match / 2; i++) {
+        name = matches[i];
+        matches[i] = matches[n_match - 1 - i];
+        matches[n_match - 1 - i] = name;
+    }
+
+    *n = n_match;
+    return matches;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Per-command scratch space: a bump allocator over a fixed buffer,
+// emptied when the command finishes.  Allocates from the bottom, or
+// from the top going down.  Returns NULL when full.
+//
+void * SimpleSerialShell::scratch(size_t size, size_t align, bool fromTop)
+{
+    bool fits;
+    size_t start;
+
+    if (fromTop) {
+        uintptr_t at = (uintptr_t)(scratchBuffer + scratchTop) - size;
+        fits = size + at % align <= scratchTop - scratchUsed;
+        start = scratchTop - size - at % align;
     }
-    // no more arguments - set redirect if set and execute
-    if (redirOk && consoleChange) {
-        consoleSave = consoleChange(NULL, &redir);
+    else {
+        uintptr_t next = (uintptr_t)(scratchBuffer + scratchUsed);
+        start = scratchUsed + (align - next % align) % align;
+        fits = start + size <= scratchTop;
     }
 
-    if (aCmd == NULL && fallback && (m_lastErrNo = fallback(argc, argv)) == 0) {
-        //
+    if (!fits) {
+        scratchMisses++;
+        return NULL;
     }
-    else if (aCmd == NULL) {
-        printf("\"%s\" command not found\n", argv[0]);
+    if (fromTop) {
+        scratchTop = start;
     }
     else {
-        m_lastErrNo = aCmd->execute(argc, argv);
+        scratchUsed = start + size;
     }
-    resetBuffer();
-
-    // restore redirect
-    if (redirOk && consoleChange) {
-        consoleChange(consoleSave, NULL);
-        redir.close();
+    if (scratchUsed + SHELL_SCRATCH_SIZE - scratchTop > scratchMax) {
+        scratchMax = scratchUsed + SHELL_SCRATCH_SIZE - scratchTop;
     }
+    return scratchBuffer + start;
+}
 
-    // cleanup memory
-    for(i = 0 ; i < nfloats ; i++)
-        free(floats[i]);
-
-    if (nfloats)
-        free(floats);
+// Everything goes but the start of a frame still coming in: it's read
+// into the bottom of the arena across polls.
+void SimpleSerialShell::emptyScratch(void)
+{
+    scratchUsed = frameGot < 0 ? 0 : frameGot < SHELL_SCRATCH_SIZE ? frameGot : SHELL_SCRATCH_SIZE;
+    scratchTop = SHELL_SCRATCH_SIZE;
+}
 
-    for (i = 0 ; i < n_matches ; i++)
-        free(matches[i]);
+size_t SimpleSerialShell::scratchPeak(void) const
+{
+    return scratchMax;
+}
 
-    if (n_matches)
-        free(matches);
+unsigned SimpleSerialShell::scratchOverflows(void) const
+{
+    return scratchMisses;
+}
 
-    return m_lastErrNo;
-  
+// is p in the shell's own line?  (after a '|', the line being run is
+// the rest of it)
+bool SimpleSerialShell::inLineBuffer(const char * p) const
+{
+    return p >= linebuffer && p < linebuffer + lineSize;
 }
 
+// argument text that the next command will reuse
+bool SimpleSerialShell::transient(const char * arg) const
+{
+    return (arg >= cmdLine && arg < cmdLine + cmdSize) ||
+           (arg >= scratchBuffer && arg < scratchBuffer + SHELL_SCRATCH_SIZE);
+}
 //////////////////////////////////////////////////////////////////////////////
-int SimpleSerialShell::lastErrNo(void)
+void SimpleSerialShell::addCommand(
+    const __FlashStringHelper * name, CommandFunction f, uint8_t g, boolean e, const __FlashStringHelper *u)
 {
-    return m_lastErrNo;
+    insert(new Command(name, f, g, e, u));
 }
 
-
-//////////////////////////////////////////////////////////////////////////////
-void SimpleSerialShell::resetBuffer(void)
+void SimpleSerialShell::addTask(
+    const __FlashStringHelper * name, TaskFunction t, uint8_t g, boolean e, const __FlashStringHelper *u)
 {
-    memset(linebuffer, 0, sizeof(linebuffer));
-    inptr = 0;
+    insert(new Command(name, NULL, g, e, u, t));
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// SimpleSerialShell::printHelp() is a static method.
-// printHelp() can access the linked list of commands.
-//
-int SimpleSerialShell::printHelp(int argc, char **argv)
+void SimpleSerialShell::insert(Command * newCmd)
 {
-    shell.println(F("Commands available are:"));
-    auto aCmd = firstCommand;  // first in list of commands.
-    while (aCmd)
-    {
-        shell.print(F("  "));
-        shell.print(aCmd->name);
-        shell.print(F("  "));
-        shell.println(aCmd->usage);
+    // insert in list alphabetically
+    // from stackoverflow...
 
-        aCmd = aCmd->next;
+    Command* temp2 = firstCommand;
+    Command** temp3 = &firstCommand;
+    while (temp2 != NULL && (newCmd->compare(temp2) > 0) )
+    {
+        temp3 = &temp2->next;
+        temp2 = temp2->next;
     }
-    return 0;	// OK or "no errors"
+    *temp3 = newCmd;
+    newCmd->next = temp2;
+
+    numCommands++;
+    indexStale = true;
 }
 
-///////////////////////////////////////////////////////////////
-// i/o stream indirection/delegation
-//
-size_t SimpleSerialShell::write(uint8_t aByte)
-{
-    return shellConnection ?
-           shellConnection->write(aByte)
-           : 0;
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @brief a command being run: its arguments and what they use.
+ *
+ *  Usually lives on the stack in execute().  A task's is kept until the
+ *  task finishes, since the arguments must stay valid between turns.
+ */
+struct SimpleSerialShell::Invocation {
+    Invocation(void)
+        : argv(NULL), argc(0),
+          redirOk(false), consoleSave(NULL), input(NULL), pipeIn(NULL), pipeOut(NULL),
+          func(NULL), task(NULL), text(NULL), frame(-1)
+    {
+        memset(&state, 0, sizeof(state));
+    };
+
+    char ** argv;   // the shell's args, or a job's own copy
+    int argc;
+    SdFile redir;
+    boolean redirOk;
+    Stream * consoleSave;
+    FileReader * input;     // the file after '<', or NULL
+    Pipe * pipeIn;          // the pipe it reads, which it owns, or NULL
+    Pipe * pipeOut;         // the pipe it writes, if it's feeding one
+    CommandFunction func;   // a plain command feeding a pipe
+    TaskFunction task;
+    TaskState state;
+    char * text;    // a job's own copy of argv and its words
+    int frame;      // ID of the framed request to answer, or -1
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @brief a file on the card read as a Stream, a block at a time: the
+ *  input of a command run with '<', or a script being sourced.
+ */
+class SimpleSerialShell::FileReader : public Stream {
+    public:
+        FileReader(void) : pos(0), len(0) {}
+        ~FileReader(void) {
+            file.close();
+        }
+
+        bool open(const char * path) {
+            return file.open(path, O_RDONLY);
+        }
+
+        virtual int available(void) {
+            if (pos == len) {
+                int n = file.read(block, sizeof(block));
+                len = n > 0 ? n : 0;
+                pos = 0;
+            }
+            return len - pos;
+        }
+
+        virtual int read(void) {
+            return available() ? block[pos++] : -1;
+        }
+
+        virtual int peek(void) {
+            return available() ? block[pos] : -1;
+        }
+
+        virtual size_t write(uint8_t) {
+            return 0;
+        }
+
+    private:
+        SdFile file;
+        uint8_t block[SHELL_REDIRECT_BUFSIZE];
+        int pos;    // next byte in block
+        int len;    // bytes in block
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @brief the pipe between two commands (a | b): a ring buffer that the
+ *  command before the '|' writes and the one after it reads.  Reading
+ *  an empty pipe gives the writer a turn.
+ */
+class SimpleSerialShell::Pipe : public Stream {
+    public:
+        Pipe(SimpleSerialShell * owner, Invocation * producer)
+            : producer(producer), reader(NULL), lost(0), stalled(false), turning(false),
+              finished(TASK_RUNNING), owner(owner), head(0), count(0) {}
+
+        Invocation * producer;  // NULL once it's finished
+        Invocation * reader;    // the task reading it; NULL for a plain command, which can't come back later
+        unsigned long lost;     // bytes written to a full pipe
+        bool stalled;           // the writer was stopped for writing nothing
+        bool turning;           // the writer is having its turn
+        int finished;           // the reader's result, if it finished during a push
+
+        // a plain writer runs in one go: when it fills the pipe, a task
+        // reading it gets a step to empty it
+        virtual size_t write(uint8_t c) {
+            if (count == sizeof(ring) && reader && finished == TASK_RUNNING) {
+                owner->pushTurn(*this);
+            }
+            if (count == sizeof(ring)) {
+                lost++;
+                return 0;
+            }
+            ring[(head + count++) % sizeof(ring)] = c;
+            return 1;
+        }
+
+        // at most one turn for the writer
+        virtual int available(void) {
+            if (count == 0 && mayTurn()) {
+                owner->pipeTurn(*this, false);
+            }
+            return count;
+        }
+
+        // these wait for the writer (a task reader gets one turn's worth);
+        // -1 when it has finished
+        virtual int read(void) {
+            int c = peek();
+            if (c >= 0) {
+                head = (head + 1) % sizeof(ring);
+                count--;
+            }
+            return c;
+        }
+
+        virtual int peek(void) {
+            for (int turns = 0; count == 0 && mayTurn(); turns++) {
+                if (turns == SHELL_PIPE_TURNS) {
+                    stalled = true;     // it's had long enough
+                    owner->pipeTurn(*this, true);
+                    break;
+                }
+                owner->pipeTurn(*this, false);
+                if (reader) {
+                    break;
+                }
+            }
+            return count ? ring[head] : -1;
+        }
+
+        bool ended(void) {
+            return count == 0 && producer == NULL;
+        }
+
+        // a plain writer feeding a task runs before the task's step, not
+        // from inside it (see stepTask())
+        bool mayTurn(void) {
+            return producer && !turning && (producer->task || !reader);
+        }
+
+    private:
+        SimpleSerialShell * owner;
+        uint8_t ring[SHELL_PIPE_SIZE];
+        size_t head;    // next byte to read
+        size_t count;   // bytes in the pipe
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Where redirected output goes on its way to the file: it's saved up and
+// written a sector at a time, so a command printing a byte at a time
+// doesn't cost (and wear) a card write per byte.  One buffer, taken from
+// the heap the first time it's needed, serves every redirected command,
+// one at a time: while a task's output goes to a file, another '>' is
+// refused.  A write that comes up short fails the command.
+//
+class RedirectSink : public Stream {
+    public:
+        RedirectSink(void) : owner(NULL), file(NULL), buffer(NULL), used(0), limit(0), failed(false) {}
+
+        // one redirected command at a time; false if another has it
+        bool claim(SdFile * f) {
+            if (owner && owner != f) {
+                return false;
+            }
+            owner = f;
+            return true;
+        }
+
+        void attach(SdFile * f) {
+            if (f != file) {
+                flush();
+                file = f;
+                // fill up to the next sector boundary, then whole sectors
+                limit = SHELL_REDIRECT_BUFSIZE - f->curPosition() % SHELL_REDIRECT_BUFSIZE;
+                if (!buffer) {
+                    buffer = (uint8_t *) malloc(SHELL_REDIRECT_BUFSIZE);
+                }
+            }
+        }
+
+        // f is about to be closed; false if some of what went to it
+        // couldn't be written
+        bool release(SdFile * f) {
+            bool ok = true;
+            if (f == file) {
+                flush();
+                file = NULL;
+                ok = !failed;
+                failed = false;
+            }
+            if (f == owner) {
+                owner = NULL;
+            }
+            return ok;
+        }
+
+        virtual size_t write(const uint8_t * buf, size_t n) {
+            if (!file) {
+                return 0;
+            }
+            if (!buffer) {
+                size_t k = file->write(buf, n);  // no RAM: unbuffered
+                failed |= k != n;
+                return k;
+            }
+            for (size_t left = n; left > 0; ) {
+                size_t k = limit - used < left ? limit - used : left;
+                memcpy(buffer + used, buf, k);
+                used += k;
+                buf += k;
+                left -= k;
+                if (used == limit) {
+                    flush();
+                }
+            }
+            return n;
+        }
+
+        virtual size_t write(uint8_t c) { return write(&c, 1); }
+
+        virtual void flush(void) {
+            if (file && used) {
+                failed |= file->write(buffer, used) != used;
+                limit = SHELL_REDIRECT_BUFSIZE;
+            }
+            used = 0;
+        }
+
+        virtual int available(void) { return 0; }
+        virtual int read(void) { return -1; }
+        virtual int peek(void) { return -1; }
+
+    private:
+        SdFile * owner; // the redirected command's file
+        SdFile * file;  // the one being written
+        uint8_t * buffer;
+        size_t used;
+        size_t limit;   // where this block ends
+        bool failed;    // a write came up short
+};
+
+static RedirectSink redirectSink;
+
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @brief a numeric argument of a framed request, kept as a number as
+ *  well as text, in the scratch arena.
+ */
+struct SimpleSerialShell::FrameNumber {
+    union {
+        long l;
+        float f;
+    } value;
+    char type;      // 'l' or 'f'
+    char text[12];  // argv points here
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ *  @brief collects Tab completion candidates for a partly typed word.
+ *
+ *  Keeps only the characters common to every candidate (no copies of the
+ *  names), or prints the candidates when listing.
+ */
+class SimpleSerialShell::Completion {
+    public:
+        Completion(const char * w, int l, char * b, int s, Print * o = NULL)
+            : word(w), len(l), buf(b), size(s), count(0), out(o) {};
+
+        // compare the start of name with word (case insensitive);
+        // 0 when name starts with word.
+        int order(PGM_P name, bool inFlash) const
+        {
+            for (int i = 0; i < len; i++) {
+                int a = tolower(inFlash ? pgm_read_byte(name + i) : (unsigned char) name[i]);
+                int b = tolower((unsigned char) word[i]);
+                if (a != b || a == '\0') {
+                    return a - b;
+                }
+            }
+            return 0;
+        };
+
+        void add(PGM_P fullName, bool inFlash)
+        {
+            PGM_P name = fullName + len;
+            if (buf == NULL) {
+                // listing
+                if (inFlash) {
+                    out->print((const __FlashStringHelper *) fullName);
+                }
+                else {
+                    out->print(fullName);
+                }
+                out->print(F("  "));
+            }
+            else if (count == 0) {
+                int i;
+                for (i = 0; i < size - 1; i++) {
+                    buf[i] = inFlash ? pgm_read_byte(name + i) : name[i];
+                    if (buf[i] == '\0') {
+                        break;
+                    }
+                }
+                buf[i] = '\0';
+            }
+            else {
+                // keep what this one has in common with the others
+                int i;
+                for (i = 0; buf[i] != '\0'; i++) {
+                    int c = inFlash ? pgm_read_byte(name + i) : (unsigned char) name[i];
+                    if (tolower(c) != tolower((unsigned char) buf[i])) {
+                        break;
+                    }
+                }
+                buf[i] = '\0';
+            }
+            count++;
+        };
+
+        const char * word;
+        int len;
+        char * buf;     // NULL when listing
+        int size;
+        int count;
+        Print * out;    // where a listing goes
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Command names are sorted, so binary search for the first name starting
+// with the word and walk forward from there.
+//
+void SimpleSerialShell::completeCommands(Completion & c)
+{
+    CommandEntry entry;
+
+    if (buildIndex()) {
+        int lo = 0;
+        int hi = numCommands;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (c.order((PGM_P) commandIndex[mid]->name, true) < 0) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        for (; lo < numCommands && c.order((PGM_P) commandIndex[lo]->name, true) == 0; lo++) {
+            if (selected((PGM_P) commandIndex[lo]->name)) {
+                c.add((PGM_P) commandIndex[lo]->name, true);
+            }
+        }
+    }
+    else {
+        for (Command * aCmd = firstCommand; aCmd != NULL; aCmd = aCmd->next) {
+            if (c.order((PGM_P) aCmd->name, true) == 0 && selected((PGM_P) aCmd->name)) {
+                c.add((PGM_P) aCmd->name, true);
+            }
+        }
+    }
+
+    for (CommandTable * table = firstTable; table != NULL; table = table->next) {
+        size_t lo = 0;
+        size_t hi = table->count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            table->getEntry(mid, entry);
+            if (c.order(entry.name, true) < 0) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        for (; lo < table->count; lo++) {
+            table->getEntry(lo, entry);
+            if (c.order(entry.name, true) != 0) {
+                break;
+            }
+            if (selected(entry.name)) {
+                c.add(entry.name, true);
+            }
+        }
+    }
+}
+
+// Is this the command its name runs, rather than one hidden by another
+// of the same name?
+bool SimpleSerialShell::selected(PGM_P name)
+{
+    char aName[32];
+    CommandEntry found;
+    size_t n = strlen_P(name);
+
+    if (n >= sizeof(aName)) {
+        return true;    // too long to look up; offer it anyway
+    }
+    memcpy_P(aName, name, n + 1);
+    return findCommand(aName, found) && found.name == name;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void SimpleSerialShell::completeFiles(Completion & c)
+{
+    const char * name;
+
+    if (!sd) {
+        return;
+    }
+    GlobIterator files(NULL, sd);
+    while ((name = files.next()) != NULL) {
+        if (c.order(name, false) == 0) {
+            c.add(name, false);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// What is being completed (the word at start, which c holds): the first
+// word is a command name, later words are file names if the command globs.
+//
+int SimpleSerialShell::completions(Completion & c, const char * line, int start)
+{
+    int first = 0;
+    while (first < start && isspace((unsigned char) line[first])) {
+        first++;
+    }
+
+    if (first == start) {
+        completeCommands(c);
+    }
+    else {
+        char aName[32];     // longer isn't a command name anyway
+        CommandEntry found;
+        int n = 0;
+        while (n < (int) sizeof(aName) - 1 && line[first + n] && !isspace((unsigned char) line[first + n])) {
+            aName[n] = line[first + n];
+            n++;
+        }
+        aName[n] = '\0';
+        if (findCommand(aName, found) && found.glob) {
+            completeFiles(c);
+        }
+    }
+    return c.count;
+}
+
+int SimpleSerialShell::complete(const char * line, int start, int end, char * buf, int size)
+{
+    Completion c(line + start, end - start, buf, size);
+    buf[0] = '\0';
+
+    if (completions(c, line, start) == 1) {
+        // unique; finish the word
+        int n = strlen(buf);
+        if (n < size - 1) {
+            buf[n++] = ' ';
+            buf[n] = '\0';
+        }
+    }
+    return c.count;
+}
+
+void SimpleSerialShell::listCompletions(const char * line, int start, int end)
+{
+    Completion c(line + start, end - start, NULL, 0, this);
+    completions(c, line, start);
+    println();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void SimpleSerialShell::addCommands(const CommandEntry * table, size_t n)
+{
+    auto * newTable = new CommandTable;
+    newTable->entries = table;
+    newTable->count = n;
+    newTable->cursor = 0;
+    newTable->next = NULL;
+
+    // keep tables in the order added
+    CommandTable ** last = &firstTable;
+    while (*last) {
+        last = &(*last)->next;
+    }
+    *last = newTable;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Binary search for a command by name (case insensitive).
+// The index is an array of pointers into the (already sorted) command list,
+// so help still walks the list in alphabetical order.
+// Commands from addCommand() win over those from tables.
+//
+// (re)build the index if needed; false if there's no memory for it.
+bool SimpleSerialShell::buildIndex(void)
+{
+    if (indexStale) {
+        Command ** newIndex = (Command **) realloc(commandIndex, sizeof(Command *) * numCommands);
+        if (newIndex != NULL) {
+            commandIndex = newIndex;
+
+            int i = 0;
+            for (Command * c = firstCommand; c != NULL; c = c->next) {
+                commandIndex[i++] = c;
+            }
+            indexStale = false;
+        }
+    }
+    return !indexStale;
+}
+
+bool SimpleSerialShell::findCommand(const char * aName, CommandEntry & found)
+{
+    Command * aCmd = NULL;
+
+    if (!buildIndex()) {
+        // out of memory for the index; walk the list instead.
+        for (aCmd = firstCommand; aCmd != NULL; aCmd = aCmd->next) {
+            if (aCmd->compareName(aName) == 0) {
+                break;
+            }
+        }
+    }
+    else {
+        int lo = 0;
+        int hi = numCommands - 1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            int comparison = commandIndex[mid]->compareName(aName);
+            if (comparison < 0) {
+                lo = mid + 1;
+            }
+            else if (comparison > 0) {
+                hi = mid - 1;
+            }
+            else {
+                // duplicate names: the most recently added sorts first
+                while (mid > 0 && commandIndex[mid - 1]->compareName(aName) == 0) {
+                    mid--;
+                }
+                aCmd = commandIndex[mid];
+                break;
+            }
+        }
+    }
+
+    if (aCmd) {
+        aCmd->getEntry(found);
+        return true;
+    }
+
+    for (CommandTable * table = firstTable; table != NULL; table = table->next) {
+        if (table->find(aName, found)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SimpleSerialShell::addFallback(int (*fb)(int argc, char **argv))
+{
+    fallback = fb;
+}
+
+void SimpleSerialShell::addStrings(char *(*s)(char *argv))
+{
+    stringExpand = s;
+}
+
+void SimpleSerialShell::addFloats(float (*s)(char *argv))
+{
+    floatExpand = s;
+}
+
+void SimpleSerialShell::addRedirector(Stream *(*f)(Stream *c, SdFile *f))
+{
+    consoleChange = f;
+}
+
+void SimpleSerialShell::addSD(SdFat *s)
+{
+    sd = s;
+}
+//////////////////////////////////////////////////////////////////////////////
+bool SimpleSerialShell::executeIfInput(int maxChars)
+{
+    bool didSomething = false;
+    char *line;
+
+    // background jobs get a turn each time
+    for (int i = 0; i < SHELL_MAXJOBS; i++) {
+        if (jobs[i] && stepTask(jobs[i], false) != TASK_RUNNING) {
+            print('[');
+            print(i + 1);
+            println(F("] done"));
+        }
+    }
+
+    if (task) {
+        // a task has the terminal: only CTRL('C') and CTRL('Z') matter
+        bool cancel = false;
+        bool suspend = false;
+        for (int n = maxChars > 0 ? maxChars : (int) lineSize; n > 0 && !cancel && shellConnection && shellConnection->available() > 0; n--) {
+            if (frameWaiting()) {
+                break;  // a frame waits for the task
+            }
+            switch (shellConnection->read()) {
+                case 0x03:  // CTRL('C') cancels it
+                    cancel = true;
+                    break;
+                case 0x1A:  // CTRL('Z') sends it to the background
+                    suspend = true;
+                    break;
+            }
+        }
+        int n;
+        // a framed request's task answers before anything else happens
+        if (suspend && !cancel && task->frame < 0 && (n = background(task)) != 0) {
+            task = NULL;
+            print('[');
+            print(n);
+            println(']');
+            reprompt();
+            return didSomething;
+        }
+        int result = stepTask(task, cancel);
+        if (result != TASK_RUNNING) {
+            m_lastErrNo = result;
+            reprompt();
+        }
+        return didSomething;
+    }
+
+    if (script) {
+        return scriptInput(maxChars > 0 ? maxChars : SHELL_BATCH_BUDGET);
+    }
+
+    if (frameGot >= 0 && millis() - frameTime > SHELL_FRAME_TIMEOUT) {
+        frameGot = -1;  // the rest of the frame never came
+        emptyScratch();
+    }
+    if (frameGot >= 0 || frameWaiting()) {
+        return frameInput(maxChars > 0 ? maxChars : SHELL_BATCH_BUDGET);
+    }
+
+    if (batch) {
+        return batchInput(shellConnection, maxChars > 0 ? maxChars : SHELL_BATCH_BUDGET);
+    }
+
+    editor.Budget = maxChars;
+    line = readline(&editor);
+
+    // keep up with the typing; an edit before what's been looked at
+    // (or a new line) starts over
+    if ((size_t) editor.Changed < scanned) {
+        rescan();
+    }
+    editor.Changed = editor.End;
+    scanLine(linebuffer, editor.End, line != NULL);
+
+    if (line && editor.Overflow) {
+        // some of it was dropped; don't run what's left
+        didSomething = true;
+        println(F("line too long"));
+        m_lastErrNo = EXIT_FAILURE;
+        lineTaken = true;
+        reprompt();
+    }
+    else if (line) {
+        didSomething = true;
+        add_history(&editor, line);     // before it's split up
+        lineTaken = true;
+        dispatch(line, true);
+        reprompt();
+    }
+    return didSomething;
+}
+
+// A new prompt, once the command the editor's last line started is
+// over.  Tasks, scripts and frames started some other way leave a
+// half-typed line alone.
+void SimpleSerialShell::reprompt(void)
+{
+    if (lineTaken && !task && !batch && !script) {
+        lineTaken = false;
+        resetline(&editor, "> ");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void SimpleSerialShell::attach(Stream & requester)
+{
+    shellConnection = &requester;
+    reprompt();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void SimpleSerialShell::setAnsi(bool on)
+{
+    editor.Ansi = on;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void SimpleSerialShell::setBatchMode(bool on)
+{
+    if (on == batch) {
+        return;
+    }
+    batch = on;
+    inptr = 0;
+    discarding = false;
+    rescan();
+    if (on) {
+        lineTaken = true;   // batch lines are read into linebuffer
+    }
+    else {
+        reprompt();         // a person again
+    }
+}
+
+bool SimpleSerialShell::batchMode(void) const
+{
+    return batch;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Batch mode input goes straight into linebuffer (a script's into a
+// line of its own), unechoed, and each line runs as soon as it ends.
+// Stops when the input or the budget runs out, a command starts a task,
+// or the input changes (batch mode turned off, a script started or
+// ended).
+//
+bool SimpleSerialShell::batchInput(Stream * in, int budget)
+{
+    bool didSomething = false;
+
+    while (!task && budget-- > 0 && in && in == lineSource() && in->available() > 0 &&
+            (in == script || !frameWaiting())) {
+        didSomething |= batchChar(in->read());
+    }
+    return didSomething;
+}
+
+// Where batch lines come from: a script, else the connection in batch
+// mode (NULL otherwise).
+Stream * SimpleSerialShell::lineSource(void)
+{
+    return script ? script : batch ? shellConnection : NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// A script's lines run the way batch lines do, without echo, a budget's
+// worth per poll; a task started by one has its turns before the next.
+// CTRL('C') stops the script.
+//
+bool SimpleSerialShell::scriptInput(int budget)
+{
+    bool didSomething = false;
+
+    // what's typed meanwhile is dropped, but for CTRL('C') (or a frame)
+    for (int n = budget; n > 0 && shellConnection && shellConnection->available() > 0 && !frameWaiting(); n--) {
+        if (shellConnection->read() == 0x03) {
+            println(F("stopped"));
+            endScript();
+            return didSomething;
+        }
+    }
+    didSomething = batchInput(script, budget);
+    if (script && !task && script->available() <= 0) {
+        if (inptr > 0) {
+            didSomething |= batchChar('\n');    // the last line didn't end
+        }
+        if (!task) {
+            endScript();
+        }
+    }
+    return didSomething;
+}
+
+void SimpleSerialShell::endScript(void)
+{
+    delete script;
+    script = NULL;
+    free(scriptLine);
+    scriptLine = NULL;
+    inptr = 0;
+    discarding = false;
+    rescan();
+    reprompt();
+}
+
+// Take one character of a batch line; true if a line was run.
+bool SimpleSerialShell::batchChar(int c)
+{
+    bool ran = false;
+    char * line = script ? scriptLine : linebuffer;
+
+    switch (c) {
+        case '\r':
+        case '\n':
+        case ';':
+            line[inptr] = '\0';
+            scanLine(line, inptr, true);
+            if (discarding) {
+                println(F("line too long"));
+                m_lastErrNo = EXIT_FAILURE;
+                ran = true;
+            }
+            else if (firstWord >= 0 && line[firstWord] != '#') {  // blank lines and comments are skipped
+                ran = true;
+                dispatch(line, true);
+            }
+            inptr = 0;
+            discarding = false;
+            rescan();
+            break;
+
+        case -1:
+        case 0:
+            break;
+
+        default:
+            if (discarding) {
+                break;
+            }
+            if (inptr >= (int) lineSize - 1) {
+                discarding = true;
+                break;
+            }
+            line[inptr++] = c;
+            scanLine(line, inptr, false);
+            break;
+    }
+    return ran;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Framed requests.  A request is
+//
+//   SYN LEN ID args... CRC
+//
+// LEN counts ID and the args; CRC is CRC-8 (polynomial 0x07) over LEN
+// through the last arg.  Each arg is a type and its value:
+//   's' text, NUL terminated
+//   'l' 32 bit integer, 'f' 32 bit float, little endian
+//   'L', 'F' the same, but argv gets "" rather than text (for commands
+//            that use toLong() and toFloat())
+// The reply is SYN 6 ID STATUS RESULT CRC, RESULT the command's 32 bit
+// return value.  A frame is read into the scratch arena, which keeps
+// what's come of it between polls, and its arguments are used from there.
+//
+void SimpleSerialShell::setFrames(bool on)
+{
+    frames = on;
+    frameGot = -1;
+}
+
+// does the next input start a frame?
+bool SimpleSerialShell::frameWaiting(void)
+{
+    return frames && shellConnection && shellConnection->available() > 0 &&
+           shellConnection->peek() == SHELL_FRAME_SYN;
+}
+
+static uint8_t crc8(uint8_t crc, uint8_t b)
+{
+    crc ^= b;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static long frameLong(const uint8_t * p)
+{
+    return (int32_t)((uint32_t) p[0] | (uint32_t) p[1] << 8 |
+                     (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+}
+
+// n in decimal, without printf
+static void longText(long n, char * text)
+{
+    char digits[12];
+    int i = 0;
+    unsigned long u = n < 0 ? 0UL - (unsigned long) n : (unsigned long) n;
+
+    do {
+        digits[i++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n < 0) {
+        *text++ = '-';
+    }
+    while (i > 0) {
+        *text++ = digits[--i];
+    }
+    *text = '\0';
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Read frames (starting with the SYN) until the input or the budget runs
+// out, running each as it completes.
+//
+bool SimpleSerialShell::frameInput(int budget)
+{
+    uint8_t * f = (uint8_t *) scratchBuffer;
+    bool didSomething = false;
+
+    while (!task && budget-- > 0 && shellConnection && shellConnection->available() > 0) {
+        int c = shellConnection->read();
+        frameTime = millis();
+        if (frameGot < 0) {
+            frameGot = 0;   // c is the SYN
+            continue;
+        }
+        if (frameGot < SHELL_SCRATCH_SIZE) {
+            f[frameGot] = c;
+        }
+        if (++frameGot == f[0] + 2) {
+            didSomething = true;
+            runFrame();
+            if (!frameWaiting()) {
+                break;      // text next, for the editor
+            }
+        }
+        else {
+            emptyScratch();     // keep what's come so far
+        }
+    }
+    return didSomething;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Check the frame at the bottom of the arena, build argv from it and run
+// the command.  The reply comes when the command (or task) finishes.
+//
+void SimpleSerialShell::runFrame(void)
+{
+    uint8_t * f = (uint8_t *) scratchBuffer;
+    int len = f[0];
+    int id = len > 0 ? f[1] : -1;
+    uint8_t crc = 0;
+    int i;
+    int got = frameGot;
+
+    frameGot = -1;          // all in; from here the arena holds it as it runs
+    if (got > SHELL_SCRATCH_SIZE || len == 0) {
+        frameReply(id, FRAME_BAD_ARGS, 0);
+        return;
+    }
+    for (i = 0; i <= len; i++) {
+        crc = crc8(crc, f[i]);
+    }
+    if (crc != f[len + 1]) {
+        frameReply(id, FRAME_BAD_CRC, 0);
+        return;
+    }
+    scratchUsed = len + 2;  // keep it while it runs
+
+    // check the arguments and count them
+    const uint8_t * first = f + 2;   // the first arg
+    const uint8_t * end = f + 1 + len;
+    const uint8_t * p;
+    int nArgs = 1;
+    int nNumbers = 0;
+    bool ok = true;
+    for (p = first; ok && p < end; nArgs++) {
+        if (*p == 's') {
+            const uint8_t * nul = (const uint8_t *) memchr(p + 1, '\0', end - p - 1);
+            ok = nul != NULL;
+            p = ok ? nul + 1 : end;
+        }
+        else if (*p && strchr("lLfF", *p) && end - p >= 5) {
+            nNumbers++;
+            p += 5;
+        }
+        else {
+            ok = false;
+        }
+    }
+
+    CommandEntry found;
+    bool known = false;
+    if (id == FRAME_LOOKUP) {
+        // "what's the ID of this name?"
+        int n = ok && nArgs == 2 && first[0] == 's' ? commandId((const char *) first + 1) : -1;
+        frameReply(id, n < 0 ? FRAME_NO_COMMAND : FRAME_OK, n);
+        scratchUsed = 0;
+        return;
+    }
+    known = commandAt(id, found);
+
+    Invocation local;
+    Invocation * run = &local;
+    char * name = NULL;
+    if (known && ok && nArgs <= maxArgs) {
+        name = (char *) scratch(strlen_P(found.name) + 1, 1);
+        numbers = (FrameNumber *) scratch(sizeof(FrameNumber) * nNumbers, sizeof(long));
+        if (found.task && name && numbers) {
+            run = new Invocation;
+        }
+    }
+    if (!known || name == NULL || numbers == NULL || run == NULL) {
+        frameReply(id, known ? FRAME_BAD_ARGS : FRAME_NO_COMMAND, 0);
+        scratchUsed = 0;
+        numbers = NULL;
+        return;
+    }
+
+    memcpy_P(name, found.name, strlen_P(found.name) + 1);
+    char ** argv = run->argv = args;
+    int & argc = run->argc;
+    argv[argc++] = name;
+    numberCount = 0;
+    for (p = first; p < end; ) {
+        if (*p == 's') {
+            argv[argc++] = (char *) p + 1;
+            p += strlen((const char *) p + 1) + 2;
+            continue;
+        }
+        FrameNumber & n = numbers[numberCount++];
+        n.type = tolower(*p);
+        n.text[0] = '\0';
+        if (n.type == 'l') {
+            n.value.l = frameLong(p + 1);
+            if (*p == 'l') {
+                longText(n.value.l, n.text);
+            }
+        }
+        else {
+            uint32_t bits = (uint32_t) frameLong(p + 1);
+            memcpy(&n.value.f, &bits, sizeof(n.value.f));
+            if (*p == 'f') {
+                snprintf(n.text, sizeof(n.text), "%f", n.value.f);
+            }
+        }
+        argv[argc++] = n.text;
+        p += 5;
+    }
+
+    cmdLine = NULL;     // leaves linebuffer to the editor
+    cmdSize = 0;
+    run->frame = id;
+    launch(run, &found, false);
+}
+
+void SimpleSerialShell::frameReply(int id, int status, long result)
+{
+    uint8_t f[9];
+
+    f[0] = SHELL_FRAME_SYN;
+    f[1] = 6;
+    f[2] = id;
+    f[3] = status;
+    for (int i = 0; i < 4; i++) {
+        f[4 + i] = (uint32_t) result >> (8 * i);
+    }
+    f[8] = 0;
+    for (int i = 1; i < 8; i++) {
+        f[8] = crc8(f[8], f[i]);
+    }
+    if (shellConnection) {
+        shellConnection->write(f, sizeof(f));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// An argument as a number: straight from a framed request when it came
+// that way, otherwise parsed from its text.
+//
+long SimpleSerialShell::toLong(const char * arg)
+{
+    const FrameNumber * n = running ? running->frameNumber(arg) : NULL;
+
+    if (n) {
+        return n->type == 'f' ? (long) n->value.f : n->value.l;
+    }
+    return arg ? atol(arg) : 0;
+}
+
+float SimpleSerialShell::toFloat(const char * arg)
+{
+    const FrameNumber * n = running ? running->frameNumber(arg) : NULL;
+
+    if (n) {
+        return n->type == 'f' ? n->value.f : (float) n->value.l;
+    }
+    return arg ? atof(arg) : 0;
+}
+
+const SimpleSerialShell::FrameNumber * SimpleSerialShell::frameNumber(const char * arg) const
+{
+    for (int i = 0; i < numberCount; i++) {
+        if (arg == numbers[i].text) {
+            return &numbers[i];
+        }
+    }
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame IDs: the addCommand() commands in name order, then each table's
+// entries in turn.  commandId() walks them (it's for setting up a peer,
+// not every request); commandAt() finds one quickly.
+//
+int SimpleSerialShell::commandId(const char * aName)
+{
+    int id = 0;
+    CommandEntry entry;
+
+    for (Command * aCmd = firstCommand; aCmd != NULL; aCmd = aCmd->next, id++) {
+        if (aCmd->compareName(aName) == 0) {
+            return id;
+        }
+    }
+    for (CommandTable * table = firstTable; table != NULL; table = table->next) {
+        for (size_t i = 0; i < table->count; i++, id++) {
+            table->getEntry(i, entry);
+            if (flashNameCompare(entry.name, aName, false) == 0) {
+                return id;
+            }
+        }
+    }
+    return -1;
+}
+
+bool SimpleSerialShell::commandAt(int id, CommandEntry & found)
+{
+    if (id < 0) {
+        return false;
+    }
+    if (id < numCommands) {
+        Command * aCmd;
+        if (buildIndex()) {
+            aCmd = commandIndex[id];
+        }
+        else {
+            for (aCmd = firstCommand; id > 0; id--) {
+                aCmd = aCmd->next;
+            }
+        }
+        aCmd->getEntry(found);
+        return true;
+    }
+    id -= numCommands;
+    for (CommandTable * table = firstTable; table != NULL; table = table->next) {
+        if (id < (int) table->count) {
+            table->getEntry(id, found);
+            return true;
+        }
+        id -= table->count;
+    }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int SimpleSerialShell::execute(const char commandString[])
+{
+    if (task) {
+        println(F("busy"));
+        return EXIT_FAILURE;
+    }
+    // the copy goes in the scratch arena, so a line being typed is left alone
+    size_t len = strlen(commandString);
+    size_t top = scratchTop;
+    char * copy = len < lineSize ? (char *) scratch(len + 1, 1, true) : NULL;
+    if (copy == NULL) {
+        println(F("line too long"));
+        return m_lastErrNo = EXIT_FAILURE;
+    }
+    strcpy(copy, commandString);
+    int result = executeInPlace(copy);
+    if (task == NULL && scratchBuffer + scratchTop == copy) {
+        scratchTop = top;       // nothing ran (an empty line); give it back
+    }
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Run the command in aCommandLine without copying it.  The words are
+// split in place, so the line is changed, and must stay put until the
+// command (or task) finishes.
+//
+int SimpleSerialShell::executeInPlace(char * aCommandLine)
+{
+    return dispatch(aCommandLine, false);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// typed: the line came from the editor, and its command may already
+// have been looked up by scanLine()
+//
+int SimpleSerialShell::dispatch(char * line, bool typed)
+{
+    if (task) {
+        println(F("busy"));
+        return EXIT_FAILURE;
+    }
+    cmdLine = line;
+    cmdSize = strlen(line) + 1;
+    return execute(typed);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Look at the line from where the last call stopped, up to end, and
+// look up the command once its first word is over (at white space, a
+// closing quote, or the end of a complete line).  Words are found the
+// way nextWord() finds them, but nothing is changed: the editor still
+// owns the line.
+//
+void SimpleSerialShell::scanLine(const char * line, size_t end, bool complete)
+{
+    for (; early == UNSEEN && scanned < end; scanned++) {
+        char c = line[scanned];
+        if (firstWord < 0) {
+            if (c == '"') {
+                firstWord = scanned + 1;
+            }
+            else if (!isspace((unsigned char) c)) {
+                firstWord = scanned;
+            }
+        }
+        else if ((firstWord > 0 && line[firstWord - 1] == '"') ?
+                 c == '"' : isspace((unsigned char) c)) {
+            lookUpEarly(line + firstWord, scanned - firstWord);
+        }
+    }
+    if (complete && early == UNSEEN && firstWord >= 0) {
+        lookUpEarly(line + firstWord, end - firstWord);
+    }
+}
+
+void SimpleSerialShell::rescan(void)
+{
+    scanned = 0;
+    firstWord = -1;
+    early = UNSEEN;
+}
+
+void SimpleSerialShell::lookUpEarly(const char * name, size_t len)
+{
+    char aName[32];
+
+    if (len >= sizeof(aName)) {
+        early = LATE;   // too long for a command; let execute() decide
+        return;
+    }
+    memcpy(aName, name, len);
+    aName[len] = '\0';
+    early = findCommand(aName, earlyCmd) ? FOUND : MISSING;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// The next word of a line, or NULL at the end.  A word ends at white
+// space; a word in "quotes" ends at the closing quote.  The word is
+// terminated in place and p moves past it.
+//
+char * SimpleSerialShell::nextWord(char * & p)
+{
+    char * start_of_word;
+    char end;
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p == '\0') {
+        return NULL;
+    }
+
+    if (*p == '"') {
+        start_of_word = ++p;
+        while (*p != '\0' && *p != '"') {
+            p++;
+        }
+    }
+    else {
+        start_of_word = p;
+        while (*p != '\0' && !isspace((unsigned char) *p)) {
+            p++;
+        }
+    }
+
+    end = *p;
+    *p = '\0';
+    if (end != '\0') {
+        p++;
+    }
+    return start_of_word;
+}
+
+// is there another word after p?
+static bool moreWords(const char * p)
+{
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    return *p != '\0';
+}
+
+int SimpleSerialShell::split(char *buffer, char **argv, int max_argv)
+{
+    char *p = buffer;
+    char *word;
+    int argc = 0;
+
+    while (argc < max_argv && (word = nextWord(p)) != NULL) {
+        argv[argc++] = word;
+    }
+
+    return argc;
+
+}
+//////////////////////////////////////////////////////////////////////////////
+int SimpleSerialShell::execute(bool typed)
+{
+    char *ptr;
+    float f;
+    boolean append;
+    char * catName;
+    CommandEntry found;
+    CommandEntry *aCmd = NULL;
+    int    i;
+    char  *anArg;
+    char  *rest = cmdLine;      // words not yet looked at
+    char  *name;
+    bool   inBackground = false;
+    bool   tooMany = false;
+    bool   noRoom = false;      // glob matches didn't all fit
+    char  *noInput = NULL;      // a '<' file that wouldn't open
+    bool   noOutput = false;    // '>' while another command's output goes to a file
+    char  *piped = NULL;        // the command after '|'
+    Pipe  *pipe = pending;      // the one before it, if this is that command
+
+    pending = NULL;
+    if (task) {
+        println(F("busy"));
+        endPipe(pipe);
+        return EXIT_FAILURE;
+    }
+
+    // words are split off as they're needed, straight into argv
+    if ((name = nextWord(rest)) == NULL)
+    {
+        // empty line; no arguments found.
+        println(F("OK"));
+        if (inLineBuffer(cmdLine)) {
+            resetBuffer();
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (typed && early == FOUND) {
+        aCmd = &earlyCmd;       // looked up while the line was typed
+    }
+    else if (findCommand(name, found)) {
+        aCmd = &found;
+    }
+
+    // a task keeps its arguments until it finishes
+    Invocation local;
+    Invocation * run = &local;
+    if (aCmd && aCmd->task) {
+        run = new Invocation;
+        if (run == NULL) {
+            println(F("out of memory"));
+            if (inLineBuffer(cmdLine)) {
+                resetBuffer();
+            }
+            endPipe(pipe);
+            return m_lastErrNo = EXIT_FAILURE;
+        }
+    }
+    run->pipeIn = pipe;
+    if (pipe && aCmd && aCmd->task) {
+        pipe->reader = run;
+    }
+    char ** argv = run->argv = args;
+    int & argc = run->argc;
+    char ** matches;
+    int n_matches;
+    char * aFloat;
+    SdFile & redir = run->redir;
+    boolean & redirOk = run->redirOk;
+    auto add = [&](char * arg) {
+        if (argc < maxArgs) {
+            argv[argc++] = arg;
+        }
+        else {
+            tooMany = true;
+        }
+    };
+
+    add(name);
+
+    // TODO: handle quoted args, glob (fnmatch), variable expansion, redirection
+    while (!tooMany && (anArg = nextWord(rest)) != NULL)
+    {
+        if (strcmp(anArg, "|") == 0) {
+            piped = rest;       // the rest is the next command's
+            break;
+        }
+        if (aCmd && aCmd -> glob && aCmd -> glob != GLOB_STREAM && (strchr(anArg, '*') || strchr(anArg, '?'))) {
+            unsigned misses = scratchMisses;
+            matches = glob(sd, anArg, &n_matches);
+            for (i = 0 ; i < n_matches ; i++) {
+                add(matches[i]);
+            }    
+            if (scratchMisses != misses) {
+                noRoom = true;
+                break;
+            }
+        }
+        else if (strcmp(anArg, "&") == 0 && !moreWords(rest)) {
+            inBackground = true;
+        }
+        else if (anArg[0] == '>' && (catName = nextWord(rest)) != NULL) {
+            if (!redirectSink.claim(&redir)) {
+                noOutput = true;    // a task's output is going to a file
+                break;
+            }
+            append = strstr(anArg, ">>") ? true : false;
+            redirOk = redir.open(catName, append ? O_WRITE | O_CREAT | O_AT_END : O_WRITE | O_CREAT | O_TRUNC);
+            if (!redirOk) {
+                redirectSink.release(&redir);
+            }
+            invalidateGlobCache();  // may have made a new file
+        }
+        else if (anArg[0] == '<' && (catName = nextWord(rest)) != NULL) {
+            delete run->input;
+            if ((run->input = new FileReader) != NULL && !run->input->open(catName)) {
+                delete run->input;
+                run->input = NULL;
+            }
+            if (run->input == NULL) {
+                noInput = catName;
+            }
+        }
+        else if (aCmd && aCmd -> expand && anArg[0] == '_' && floatExpand) {
+            f = floatExpand(anArg + 1);
+            if (isnan(f)) {
+                add(NULL); // or empty string?
+            }
+            else if ((aFloat = (char *) scratch(12, 1)) != NULL) {
+                snprintf(aFloat, 10, "%f", f);
+                add(aFloat);
+            }    
+            else {
+                add(NULL);
+            }
+        }
+        else if (aCmd && aCmd -> expand && anArg[0] == '$' && stringExpand) {
+            if ((ptr = stringExpand(anArg + 1)) != NULL)
+                add(ptr);
+            else
+                add(NULL); // or empty string??
+        }
+        else {
+            add(anArg);
+        } 
+    }
+
+    if (tooMany || noRoom || noInput || noOutput) {
+        if (noInput) {
+            print(noInput);
+            println(F(": can't open"));
+        }
+        else if (noOutput) {
+            println(F("output already redirected"));
+        }
+        else if (noRoom) {
+            println(F("too many matches"));
+        }
+        else {
+            // rather than quietly dropping some
+            println(F("too many arguments"));
+        }
+        finish(*run);
+        if (run != &local) {
+            delete run;
+        }
+        return m_lastErrNo = EXIT_FAILURE;
+    }
+    if (piped) {
+        return pipeline(run, aCmd, piped);
+    }
+    return launch(run, aCmd, inBackground);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Start "a | b": a (whose arguments are ready in run) gets its own copy
+// of them and feeds a pipe, then b is parsed from the rest of the line
+// (which may hold more pipes) and run reading it.  a only runs when b
+// reads.
+//
+int SimpleSerialShell::pipeline(Invocation * run, CommandEntry * aCmd, char * rest)
+{
+    Invocation * producer = run;
+    Pipe * pipe = NULL;
+
+    if (aCmd == NULL || !moreWords(rest)) {
+        println(aCmd ? F("nothing after |") : F("command not found"));
+        finish(*run);
+        if (aCmd && aCmd->task) {
+            delete run;
+        }
+        return m_lastErrNo = EXIT_FAILURE;
+    }
+
+    if (run->redirOk) {
+        redirectSink.release(&run->redir);
+        run->redir.close();     // its output goes in the pipe
+        run->redirOk = false;
+    }
+    if (!aCmd->task && (producer = new Invocation) != NULL) {
+        // it has to outlive this call
+        producer->argc = run->argc;
+        producer->argv = run->argv;
+        producer->input = run->input;
+        producer->pipeIn = run->pipeIn;
+        producer->func = aCmd->func;
+        run->input = NULL;
+        run->pipeIn = NULL;
+    }
+    if (producer == NULL || !keep(producer) || (pipe = new Pipe(this, producer)) == NULL) {
+        println(F("out of memory"));
+        finish(*(producer ? producer : run));
+        if (producer) {
+            delete producer;
+        }
+        return m_lastErrNo = EXIT_FAILURE;
+    }
+    producer->task = aCmd->task;
+    producer->pipeOut = pipe;
+
+    pending = pipe;
+    cmdLine = rest;
+    cmdSize = strlen(rest) + 1;
+    return execute(false);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Give the command feeding a pipe a turn (its last, if cancelled), with
+// its output going into the pipe.
+//
+void SimpleSerialShell::pipeTurn(Pipe & pipe, bool cancel)
+{
+    Invocation * run = pipe.producer;
+    Stream * in = input;
+    Stream * out = output;
+    Pipe * from = reading;
+    int result;
+
+    if (cancel) {
+        run->state.cancelled = true;
+    }
+
+    pipe.turning = true;
+    if (run->task) {
+        result = callTask(run);
+    }
+    else {
+        redirect(*run, true);
+        SimpleSerialShell * caller = running;
+        running = this;
+        result = run->func(run->argc, run->argv);
+        running = caller;
+        redirect(*run, false);
+    }
+    pipe.turning = false;
+
+    if (!run->task || result != TASK_RUNNING || run->state.cancelled) {
+        pipe.producer = NULL;   // the end of the pipe
+        finish(*run);
+        delete run;
+    }
+    input = in;     // back to the reader's
+    output = out;
+    reading = from;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// A plain command has filled the pipe it writes: give the task reading
+// it a step to make room.  If that finishes the task, its result waits
+// in the pipe for callTask().
+//
+void SimpleSerialShell::pushTurn(Pipe & pipe)
+{
+    Invocation * run = pipe.reader;
+    Stream * in = input;
+    Stream * out = output;
+    Pipe * from = reading;
+
+    redirect(*run, true);
+    int result = run->task(run->argc, run->argv, run->state);
+    redirect(*run, false);
+    if (result != TASK_RUNNING) {
+        pipe.finished = result;
+    }
+    input = in;     // back to the writer's
+    output = out;
+    reading = from;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// The reader of a pipe is done with it: stop the writer if need be.
+// false if some of what was written never got through.
+//
+bool SimpleSerialShell::endPipe(Pipe * pipe)
+{
+    if (pipe == NULL) {
+        return true;
+    }
+    if (pipe->producer) {
+        if (pipe->producer->task) {
+            pipeTurn(*pipe, true);
+        }
+        else {
+            finish(*pipe->producer);
+            delete pipe->producer;
+        }
+    }
+    bool whole = pipe->lost == 0 && !pipe->stalled;
+    if (pipe->lost) {
+        print(pipe->lost);
+        println(F(" bytes lost (pipe full)"));
+    }
+    if (pipe->stalled) {
+        println(F("pipe stalled"));
+    }
+    delete pipe;
+    return whole;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Run a command whose arguments are ready: as a task (run was new'ed for
+// it, and is kept until it finishes) or to completion.
+//
+int SimpleSerialShell::launch(Invocation * run, CommandEntry * aCmd, bool inBackground)
+{
+    int argc = run->argc;
+    char ** argv = run->argv;
+
+    if (aCmd && aCmd->task) {
+        run->task = aCmd->task;
+        if (inBackground) {
+            // prompt comes straight back; the job gets its turns later
+            int n = background(run);
+            if (n == 0) {
+                println(F("too many jobs"));
+                finish(*run);
+                delete run;
+                return m_lastErrNo = EXIT_FAILURE;
+            }
+            print('[');
+            print(n);
+            println(']');
+            return m_lastErrNo = EXIT_SUCCESS;
+        }
+        task = run;
+        int result = stepTask(task, false);
+        if (result != TASK_RUNNING) {
+            m_lastErrNo = result;   // only a finished command's status
+        }
+        return result;
+    }
+
+    redirect(*run, true);
+    SimpleSerialShell * caller = running;
+    running = this;
+    if (aCmd == NULL && fallback && (m_lastErrNo = fallback(argc, argv)) == 0) {
+        //
+    }
+    else if (aCmd == NULL) {
+        if (!fallback) {
+            m_lastErrNo = -1;
+        }
+        print('"');
+        print(argv[0]);
+        print(F("\": "));
+        print(m_lastErrNo);
+        println(F(": command not found"));
+    }
+    else {
+        m_lastErrNo = aCmd->func(argc, argv);
+    }
+    running = caller;
+    redirect(*run, false);
+    if (!finish(*run)) {
+        m_lastErrNo = EXIT_FAILURE;
+    }
+    if (run->frame >= 0) {
+        frameReply(run->frame, FRAME_OK, m_lastErrNo);
+    }
+
+    return m_lastErrNo;
+  
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Send output to the file named after '>' (if any) while a command runs,
+// and put it back afterwards.  It reaches the file through redirectSink.
+// Input from the file after '<' (if any) likewise, and a pipe's ends.
+//
+void SimpleSerialShell::redirect(Invocation & inv, bool on)
+{
+    if (on) {
+        input = inv.input ? (Stream *) inv.input : inv.pipeIn;
+        reading = inv.input ? NULL : inv.pipeIn;
+        output = inv.pipeOut;
+    }
+    else {
+        input = output = NULL;
+        reading = NULL;
+    }
+    if (inv.redirOk && consoleChange) {
+        if (on) {
+            redirectSink.attach(&inv.redir);
+            inv.consoleSave = consoleChange(&redirectSink, NULL);
+        }
+        else {
+            consoleChange(inv.consoleSave, NULL);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Give a task (the foreground one or a job) its next turn.  Returns
+// TASK_RUNNING while it has more to do; otherwise its result, and the
+// slot is emptied.  A cancelled task gets one last call to clean up.
+//
+int SimpleSerialShell::stepTask(Invocation * & slot, bool cancel)
+{
+    Invocation * run = slot;
+    int result;
+
+    if (cancel) {
+        run->state.cancelled = true;
+    }
+
+    result = callTask(run);
+
+    if (result == TASK_RUNNING && run->state.cancelled) {
+        result = EXIT_FAILURE; // didn't stop when asked
+    }
+    if (result != TASK_RUNNING) {
+        slot = NULL;
+        if (!finish(*run)) {
+            result = EXIT_FAILURE;
+        }
+        if (run->frame >= 0) {
+            frameReply(run->frame, FRAME_OK, result);
+        }
+        delete run;
+    }
+    return result;
+}
+
+// One step of a task, with its input and output.  A plain command
+// feeding it runs first, pushing its output through (see pushTurn()).
+int SimpleSerialShell::callTask(Invocation * run)
+{
+    Pipe * pipe = run->pipeIn;
+
+    if (pipe && pipe->producer && !pipe->producer->task && !run->state.cancelled) {
+        pipeTurn(*pipe, false);
+    }
+    if (pipe && pipe->finished != TASK_RUNNING) {
+        return pipe->finished;
+    }
+
+    redirect(*run, true);
+    SimpleSerialShell * caller = running;
+    running = this;
+    int result = run->task(run->argc, run->argv, run->state);
+    running = caller;
+    redirect(*run, false);
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Move a task into the job table.  Its argv is the shell's, and the
+// arguments point into its line and the scratch arena, all of which the
+// next command will reuse, so they are packed into a copy of their own.
+// Returns the job number, or 0 if the table is full (or there's no memory
+// for the copy).
+//
+int SimpleSerialShell::background(Invocation * run)
+{
+    int slot;
+
+    for (slot = 0; slot < SHELL_MAXJOBS && jobs[slot] != NULL; slot++)
+        ;
+    if (slot == SHELL_MAXJOBS) {
+        return 0;
+    }
+
+    if (run->text == NULL) {
+        if (!keep(run)) {
+            return 0;
+        }
+        if (inLineBuffer(cmdLine)) {
+            resetBuffer();
+        }
+        emptyScratch();
+    }
+    jobs[slot] = run;
+    return slot + 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Pack the arguments of a command that must outlive its line into a
+// copy of its own.  false if there's no memory for it.
+//
+bool SimpleSerialShell::keep(Invocation * run)
+{
+    int i;
+
+    if (run->text == NULL) {
+        size_t used = sizeof(char *) * run->argc;
+        for (i = 0; i < run->argc; i++) {
+            if (run->argv[i] && transient(run->argv[i])) {
+                used += strlen(run->argv[i]) + 1;
+            }
+        }
+        // argv first (so it's aligned), then the words
+        char ** argv;
+        char * p;
+        if ((run->text = (char *) malloc(used ? used : 1)) == NULL) {
+            return false;
+        }
+        argv = (char **) run->text;
+        p = (char *)(argv + run->argc);
+        for (i = 0; i < run->argc; i++) {
+            argv[i] = run->argv[i];
+            if (argv[i] && transient(argv[i])) {
+                strcpy(p, argv[i]);
+                argv[i] = p;
+                p += strlen(p) + 1;
+            }
+        }
+        run->argv = argv;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Built-in job control, for the session running the command:
+//   jobs        list background jobs
+//   fg [n]      bring job n (default: the first) to the foreground
+//   kill n      cancel job n
+//
+int SimpleSerialShell::jobsCommand(int argc, char **argv)
+{
+    SimpleSerialShell * me = running;
+
+    (void) argc;
+    (void) argv;
+
+    for (int i = 0; i < SHELL_MAXJOBS; i++) {
+        Invocation * job = me->jobs[i];
+        if (job) {
+            me->print('[');
+            me->print(i + 1);
+            me->print(F("] "));
+            for (int a = 0; a < job->argc; a++) {
+                me->print(job->argv[a] ? job->argv[a] : "");
+                me->print(' ');
+            }
+            me->println('&');
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int SimpleSerialShell::fgCommand(int argc, char **argv)
+{
+    SimpleSerialShell * me = running;
+    int n = me->findJob(argc, argv);
+
+    if (n < 0) {
+        return EXIT_FAILURE;
+    }
+    // the prompt waits until the task finishes
+    me->task = me->jobs[n];
+    me->jobs[n] = NULL;
+    return EXIT_SUCCESS;
+}
+
+int SimpleSerialShell::killCommand(int argc, char **argv)
+{
+    SimpleSerialShell * me = running;
+    int n = argc > 1 ? me->findJob(argc, argv) : -1;
+
+    if (n < 0) {
+        return EXIT_FAILURE;
+    }
+    me->stepTask(me->jobs[n], true);
+    return EXIT_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Built-in "batch on|off", see setBatchMode()
+//
+int SimpleSerialShell::batchCommand(int argc, char **argv)
+{
+    SimpleSerialShell * me = running;
+
+    if (argc != 2 || (strcmp(argv[1], "on") != 0 && strcmp(argv[1], "off") != 0)) {
+        me->println(F("batch on|off"));
+        return EXIT_FAILURE;
+    }
+    me->setBatchMode(strcmp(argv[1], "on") == 0);
+    return EXIT_SUCCESS;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Built-in "source file": run the commands in a file on the card, one
+// line at a time, starting with the next poll.
+//
+int SimpleSerialShell::sourceCommand(int argc, char **argv)
+{
+    SimpleSerialShell * me = running;
+
+    if (argc != 2) {
+        me->println(F("source file"));
+        return EXIT_FAILURE;
+    }
+    if (me->script) {
+        me->println(F("already running a script"));
+        return EXIT_FAILURE;
+    }
+    FileReader * f = new FileReader;
+    char * line = (char *) malloc(me->lineSize);
+    if (f == NULL || line == NULL) {
+        delete f;
+        free(line);
+        me->println(F("out of memory"));
+        return EXIT_FAILURE;
+    }
+    if (!f->open(argv[1])) {
+        delete f;
+        free(line);
+        me->print(argv[1]);
+        me->println(F(": can't open"));
+        return EXIT_FAILURE;
+    }
+    me->script = f;
+    me->scriptLine = line;
+    me->rescan();
+    return EXIT_SUCCESS;
+}
+
+// job number from argv[1] (or the first job), as an index; -1 if none
+int SimpleSerialShell::findJob(int argc, char **argv)
+{
+    int n = -1;
+
+    if (argc > 1) {
+        n = atoi(argv[1][0] == '%' ? argv[1] + 1 : argv[1]) - 1;
+    }
+    else {
+        for (n = 0; n < SHELL_MAXJOBS && jobs[n] == NULL; n++)
+            ;
+    }
+    if (n < 0 || n >= SHELL_MAXJOBS || jobs[n] == NULL) {
+        println(F("no such job"));
+        return -1;
+    }
+    return n;
+}
+
+bool SimpleSerialShell::taskRunning(void) const
+{
+    if (task) {
+        return true;
+    }
+    for (int i = 0; i < SHELL_MAXJOBS; i++) {
+        if (jobs[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SimpleSerialShell::busy(void) const
+{
+    return script != NULL || taskRunning();
+}
+
+bool SimpleSerialShell::inputEnded(void)
+{
+    SimpleSerialShell * me = (this == &shell && running) ? running : this;
+    if (me->reading) {
+        return me->reading->peek() < 0 && me->reading->ended();
+    }
+    return me->input && me->input->peek() < 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Release what a finished command held.  false if the pipe it read
+// lost some of its input, or its output didn't all reach its file,
+// which fails the command.
+//
+bool SimpleSerialShell::finish(Invocation & inv)
+{
+    if (inv.text) {
+        free(inv.text);
+    }
+    else {
+        if (inLineBuffer(cmdLine)) {
+            resetBuffer();
+        }
+        emptyScratch();
+        numbers = NULL;
+        numberCount = 0;
+    }
+
+    bool written = true;
+    if (inv.redirOk) {
+        written = redirectSink.release(&inv.redir);
+        inv.redir.close();
+        if (!written) {
+            println(F("output not all written"));
+        }
+    }
+    delete inv.input;
+    inv.input = NULL;
+    bool whole = endPipe(inv.pipeIn);
+    inv.pipeIn = NULL;
+    return whole && written;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int SimpleSerialShell::lastErrNo(void)
+{
+    return m_lastErrNo;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+void SimpleSerialShell::resetBuffer(void)
+{
+    linebuffer[0] = '\0';
+    inptr = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// SimpleSerialShell::printHelp() is a static method.
+// printHelp() can access the linked list of commands.
+// Commands from tables are merged in so the listing stays alphabetical;
+// one hidden by a command of the same name is left out.
+//
+int SimpleSerialShell::printHelp(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    shell.println(F("Commands available are:"));
+    auto aCmd = firstCommand;  // first in list of commands.
+    CommandTable * table;
+    CommandEntry entry;
+    CommandEntry best;
+    const char * shown = NULL;  // name of the last one listed
+
+    for (table = firstTable; table != NULL; table = table->next) {
+        table->cursor = 0;
+    }
+
+    for (;;)
+    {
+        CommandTable * bestTable = NULL;
+        bool haveBest = false;
+
+        if (aCmd) {
+            aCmd->getEntry(best);
+            haveBest = true;
+        }
+        for (table = firstTable; table != NULL; table = table->next) {
+            if (table->cursor >= table->count) {
+                continue;
+            }
+            table->getEntry(table->cursor, entry);
+            if (!haveBest || flashNameCompare(entry.name, best.name, true) < 0) {
+                best = entry;
+                bestTable = table;
+                haveBest = true;
+            }
+        }
+        if (!haveBest) {
+            break;
+        }
+
+        if (shown == NULL || flashNameCompare(best.name, shown, true) != 0) {
+            shell.print(F("  "));
+            shell.print((const __FlashStringHelper *) best.name);
+            shell.print(F("  "));
+            if (best.usage) {
+                shell.print((const __FlashStringHelper *) best.usage);
+            }
+            shell.println();
+            shown = best.name;
+        }
+
+        if (bestTable) {
+            bestTable->cursor++;
+        }
+        else {
+            aCmd = aCmd->next;
+        }
+    }
+    return 0;	// OK or "no errors"
+}
+
+///////////////////////////////////////////////////////////////
+// i/o stream indirection/delegation
+//
+// Commands print to the global 'shell', so while one runs that goes to
+// the session the command came from (or the pipe the command feeds).
+Stream * SimpleSerialShell::connection(void)
+{
+    SimpleSerialShell * me = (this == &shell && running) ? running : this;
+    return me->output ? me->output : me->shellConnection;
+}
+
+size_t SimpleSerialShell::write(uint8_t aByte)
+{
+    Stream * s = connection();
+    return s ?
+           s->write(aByte)
+           : 0;
+}
+
+// pass whole buffers through, so the stream can send them in one transfer
+size_t SimpleSerialShell::write(const uint8_t *buffer, size_t size)
+{
+    Stream * s = connection();
+    return s ?
+           s->write(buffer, size)
+           : 0;
+}
+
+// ... and reading gets the file after '<' instead, if there was one
+Stream * SimpleSerialShell::inputConnection(void)
+{
+    SimpleSerialShell * me = (this == &shell && running) ? running : this;
+    return me->input ? me->input : me->shellConnection;
 }
 
 int SimpleSerialShell::available()
 {
-    return shellConnection ? shellConnection->available() : 0;
+    Stream * s = inputConnection();
+    return s ? s->available() : 0;
 }
 
 int SimpleSerialShell::read()
 {
-    return shellConnection ? shellConnection->read() : 0;
+    Stream * s = inputConnection();
+    return s ? s->read() : 0;
 }
 
 int SimpleSerialShell::peek()
 {
-    return shellConnection ? shellConnection->peek() : 0;
+    Stream * s = inputConnection();
+    return s ? s->peek() : 0;
 }
 
 void SimpleSerialShell::flush()
 {
-    if (shellConnection)
-        shellConnection->flush();
+    Stream * s = connection();
+    if (s)
+        s->flush();
 }
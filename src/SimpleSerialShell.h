@@ -2,6 +2,48 @@
 #ifndef SIMPLE_SERIAL_SHELL_H
 #define SIMPLE_SERIAL_SHELL_H
 
+#include "editline.h"
+
+#if !defined(SHELL_LINE_SIZE)
+#define SHELL_LINE_SIZE 88      // default longest line + 1
+#endif
+
+#if !defined(SHELL_MAXARGS)
+#define SHELL_MAXARGS 10        // default most arguments, with the command
+#endif
+
+#if !defined(SHELL_SCRATCH_SIZE)
+#define SHELL_SCRATCH_SIZE 128  // bytes for expanded arguments, per shell
+#endif
+
+#if !defined(SHELL_MAXJOBS)
+#define SHELL_MAXJOBS 4     // background tasks per shell
+#endif
+
+#if !defined(SHELL_BATCH_BUDGET)
+#define SHELL_BATCH_BUDGET 256  // default chars read per poll in batch mode
+#endif
+
+#if !defined(SHELL_FRAME_SYN)
+#define SHELL_FRAME_SYN 0x16    // starts a framed request, see setFrames()
+#endif
+
+#if !defined(SHELL_FRAME_TIMEOUT)
+#define SHELL_FRAME_TIMEOUT 100 // ms a frame may stall before it's dropped
+#endif
+
+#if !defined(SHELL_REDIRECT_BUFSIZE)
+#define SHELL_REDIRECT_BUFSIZE 512  // bytes read from or written to a file at a time
+#endif
+
+#if !defined(SHELL_PIPE_SIZE)
+#define SHELL_PIPE_SIZE 128     // bytes a pipe (a | b) holds
+#endif
+
+#if !defined(SHELL_PIPE_TURNS)
+#define SHELL_PIPE_TURNS 1000   // turns a reader waits for a writer that writes nothing
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 /*!
  *  @file SimpleSerialShell.h
@@ -11,36 +53,220 @@
  *  Depends on Stream.  The shell is an instance of Stream so anthing that
  *  works with a Stream should also work with the shell.
  *
+ *  Each SimpleSerialShell edits its own line and keeps its own history,
+ *  so one sketch can serve several streams (Serial, Serial1, a TCP or BLE
+ *  client), each attached to its own shell.  Commands are shared by all
+ *  of them.  While a command runs, the global 'shell' talks to the stream
+ *  the command came from.
+ *
  *  @section author Phil Jansen
  */
 class SimpleSerialShell : public Stream {
     public:
-        SimpleSerialShell(void);
+        // line holds the command being run (lineSize includes the
+        // terminating NUL) and argv its arguments, up to maxArgs of them.
+        // SizedSerialShell below supplies both.
+        SimpleSerialShell(char * line, size_t lineSize, char ** argv, int maxArgs);
+        ~SimpleSerialShell(void);
 
         // Unix-style (from 1970!)
         // functions must have a signature like: "int hello(int argc, char ** argv)"
         typedef int (*CommandFunction)(int, char ** );
         //
         //void addCommand(const char * name, CommandFunction f);
-        void addCommand(const __FlashStringHelper * name, CommandFunction f, boolean g, boolean expand, const __FlashStringHelper *usage);
+        void addCommand(const __FlashStringHelper * name, CommandFunction f, uint8_t g, boolean expand, const __FlashStringHelper *usage);
+
+        // g (glob) is false, true to expand wildcard arguments into the
+        // matching file names, or GLOB_STREAM to leave them as they are
+        // for the command to walk with a GlobIterator -- no limit on the
+        // number of matches, and no memory used for them:
+        //
+        //   int rm(int argc, char ** argv)
+        //   {
+        //       for (int i = 1; i < argc; i++) {
+        //           SimpleSerialShell::GlobIterator files(argv[i]);
+        //           while (const char * name = files.next()) {
+        //               sd.remove(name);
+        //           }
+        //       }
+        //       SimpleSerialShell::invalidateGlobCache();
+        //       return 0;
+        //   }
+        static const uint8_t GLOB_STREAM = 2;
+
+        // A task is a command that can take many turns, so a slow one
+        // (streaming data, walking the SD card) doesn't stall loop().
+        // Each executeIfInput() gives it another turn until it returns
+        // something other than TASK_RUNNING.  state starts zeroed and is
+        // kept between turns; CTRL-C sets cancelled, and the task should
+        // then clean up and return.  While a task runs, other input is
+        // thrown away.
+        //
+        // "count 5 &" runs a task in the background and the prompt comes
+        // right back.  Each executeIfInput() gives every background job a
+        // turn too.  Built-in commands "jobs", "fg [n]" and "kill n" manage
+        // them, and CTRL-Z sends the foreground task to the background.
+        // (A plain command ignores the '&'.)
+        //
+        //   int count(int argc, char **argv, SimpleSerialShell::TaskState & t)
+        //   {
+        //       if (t.cancelled || t.step == 10) return 0;
+        //       shell.println(t.step++);
+        //       return SimpleSerialShell::TASK_RUNNING;
+        //   }
+        //
+        struct TaskState {
+            int step;
+            long value;
+            void * data;
+            boolean cancelled;
+        };
+        typedef int (*TaskFunction)(int, char **, TaskState &);
+        static const int TASK_RUNNING = -32767 - 1;
+        void addTask(const __FlashStringHelper * name, TaskFunction t, uint8_t g, boolean expand, const __FlashStringHelper *usage);
+        // a task in the foreground or background?
+        bool taskRunning(void) const;
+        // work to do without any input: a task or a script running?
+        bool busy(void) const;
+        // the running command's '<' file or pipe has nothing more for it.
+        // A task reading a pipe gets -1 from read() while the writer has
+        // nothing yet, and should try again on its next turn.
+        bool inputEnded(void);
+
+        // A command kept entirely in flash.  name and usage are PROGMEM
+        // strings (usage may be NULL).
+        struct CommandEntry {
+            const char * name;
+            CommandFunction func;
+            uint8_t glob;       // false, true or GLOB_STREAM
+            boolean expand;
+            const char * usage;
+            TaskFunction task;  // instead of func (NULL for a plain command)
+        };
+
+        // Add a whole table of commands without copying it to RAM.
+        // The table must live in flash (PROGMEM) and be sorted by name
+        // (case insensitive, no duplicates) -- check with isSorted():
+        //
+        //   static const char echoName[] PROGMEM = "echo";
+        //   ...
+        //   constexpr SimpleSerialShell::CommandEntry commands[] PROGMEM = {
+        //       { echoName, echo, false, true, echoUsage, NULL },
+        //       ...
+        //   };
+        //   static_assert(SimpleSerialShell::isSorted(commands), "sort commands by name");
+        //   ...
+        //   shell.addCommands(commands);
+        //
+        // Commands added with addCommand() are searched first.
+        template <size_t N>
+        void addCommands(const CommandEntry (&table)[N])
+        {
+            addCommands(table, N);
+        }
+        void addCommands(const CommandEntry * table, size_t n);
+
+        template <size_t N>
+        static constexpr bool isSorted(const CommandEntry (&table)[N], size_t i = 1)
+        {
+            return i >= N ||
+                   (nameOrder(table[i - 1].name, table[i].name) < 0 && isSorted(table, i + 1));
+        }
 
         void attach(Stream & shellSource);
+        // terminal understands ANSI/VT-100 cursor movement (not the
+        // Arduino Serial Monitor): lets line editing send less
+        void setAnsi(bool on);
+        // Batch mode is for scripts and test rigs, not people: no echo,
+        // prompt or editing.  Lines end at '\n', '\r' or ';', and each
+        // executeIfInput() runs every line that has arrived (up to
+        // maxChars, default SHELL_BATCH_BUDGET).  Lines waiting behind a
+        // task stay queued.  Also the built-in command "batch on|off".
+        void setBatchMode(bool on);
+        bool batchMode(void) const;
+
+        // Framed requests, for programs rather than people, on the same
+        // stream as typed lines.  With setFrames(true), SHELL_FRAME_SYN
+        // starts a binary request that names a command by its ID and
+        // carries typed arguments; the reply frame has the result (see
+        // the README for the layout).  IDs count the addCommand()
+        // commands in name order, then each addCommands() table.
+        // Numbers arrive as numbers: toLong() and toFloat() read any
+        // argument, skipping the parsing when it came that way.
+        enum FrameStatus { FRAME_OK, FRAME_BAD_CRC, FRAME_NO_COMMAND, FRAME_BAD_ARGS };
+        static const int FRAME_LOOKUP = 255;    // ID of "what's this name's ID?"
+        void setFrames(bool on);
+        static int commandId(const char * aName);   // -1 if none
+        static long toLong(const char * arg);
+        static float toFloat(const char * arg);
         void addFallback(int (*fb)(int argc, char **argv));
         void addStrings(char *(*stringVar)(char *arg));
         void addFloats(float (*floatVar)(char *arg));
+        // redirect(c, NULL) sends console output to c and returns the
+        // stream it replaces.  For '>' the shell passes a stream that
+        // writes the file SHELL_REDIRECT_BUFSIZE bytes at a time.
         void addRedirector(Stream *(*redirect)(Stream *c, SdFile *f));
         void addSD(SdFat *s);
 
         // check for a complete command and run it if available
-        // non blocking
-        bool executeIfInput(void);  // returns true when command attempted
+        // non blocking; reads at most maxChars (0: the editor's default)
+        bool executeIfInput(int maxChars = 0);  // returns true when command attempted
+        // what the last command to finish returned (a task's, once it's done)
         int lastErrNo(void);
 
-        char **glob(SdFat *, char *, int *);
+        // Expanded arguments (_float values, glob matches) go in a fixed
+        // scratch arena of SHELL_SCRATCH_SIZE bytes, emptied after each
+        // command, so expanding arguments doesn't use the heap.  To
+        // size it: the most ever used, and how often it ran out.
+        size_t scratchPeak(void) const;
+        unsigned scratchOverflows(void) const;
+
+        char **glob(SdFat *, char *, int *);  // results last until the command ends
+
+        // The names in the current directory matching spec (all of them
+        // if spec is NULL), one at a time.  sd defaults to the card of
+        // the shell running the command.  Each name lasts until the
+        // next call.
+        class GlobIterator {
+            public:
+                GlobIterator(const char * spec, SdFat * sd = NULL);
+                ~GlobIterator(void);
+                const char * next(void);    // NULL after the last
+
+            private:
+                const char * spec;
+                SdFile root;
+                char name[16];
+                const char * cached;    // next name in the cache, if from there
+                bool filling;           // putting names in the cache
+                bool reader;            // counted as using the cache
+                unsigned changes;       // the cache's invalidations when filling began
+                friend class SimpleSerialShell;
+        };
+
+        // Lend RAM to remember the names in the current directory, so
+        // globs and tab completion don't read the card every time.  The
+        // cache holds one directory (all or nothing).  Output redirection
+        // clears it; call invalidateGlobCache() after changing files
+        // yourself.  Shared by every session.
+        static void setGlobCache(char * buffer, size_t size);
+        static void invalidateGlobCache(void);
+        // While a foreground task runs, execute() prints "busy" and
+        // returns EXIT_FAILURE: the task is using the shell's argv.
+        // Background jobs don't get in the way.
         int execute( const char aCommandString[]);  // shell.execute("echo hello world");
+        // same, but splits the words in place rather than copying the
+        // line; it must stay unchanged until the command finishes
+        int executeInPlace(char * aCommandLine);
         int split(char *, char **, int);
         static int printHelp(int argc, char **argv);
 
+        // Tab completion of line[start..end): a command name, or a file
+        // name for commands that glob.  Copies what can be added into buf
+        // and returns the number of candidates.
+        int complete(const char * line, int start, int end, char * buf, int size);
+        void listCompletions(const char * line, int start, int end);
+
         void resetBuffer(void);
 
         // this shell delegates communication to/from the attached stream
@@ -48,6 +274,8 @@ class SimpleSerialShell : public Stream {
         // Note changing streams may intermix serial data
         //
         virtual size_t write(uint8_t);
+        virtual size_t write(const uint8_t *buffer, size_t size);
+        using Print::write; // keep write(const char *) etc. visible
         virtual int available();
         virtual int read();
         virtual int peek();
@@ -56,15 +284,105 @@ class SimpleSerialShell : public Stream {
     private:
         Stream * shellConnection;
         int m_lastErrNo;
-        int execute(void);
+        struct Invocation;
+        Invocation * task;      // task in progress, or NULL
+        Invocation * jobs[SHELL_MAXJOBS];   // background tasks
+        int stepTask(Invocation * & slot, bool cancel);
+        int callTask(Invocation * run);
+
+        char scratchBuffer[SHELL_SCRATCH_SIZE];
+        size_t scratchUsed;     // bottom part in use
+        size_t scratchTop;      // start of the top part in use
+        size_t scratchMax;
+        unsigned scratchMisses;
+        void * scratch(size_t size, size_t align, bool fromTop = false);
+        void emptyScratch(void);
+        bool transient(const char * arg) const;
+        bool inLineBuffer(const char * p) const;
+        int background(Invocation * run);
+        int findJob(int argc, char **argv);
+        static int jobsCommand(int argc, char **argv);
+        static int fgCommand(int argc, char **argv);
+        static int killCommand(int argc, char **argv);
+        static int batchCommand(int argc, char **argv);
+        bool batch;
+        bool discarding;        // batch line too long; skip to its end
+        Stream * lineSource(void);
+        bool batchInput(Stream * in, int budget);
+        bool batchChar(int c);
+
+        // '<' files and "source" scripts are read a block at a time
+        class FileReader;
+        FileReader * script;    // the script being run, or NULL
+        char * scriptLine;      // its line, apart from the editor's
+        Stream * input;         // the running command's '<' file or pipe, or NULL
+        Stream * output;        // the pipe it writes, or NULL
+        static int sourceCommand(int argc, char **argv);
+        bool scriptInput(int budget);
+        void endScript(void);
+
+        // a | b: a writes a pipe that b reads, taking turns
+        class Pipe;
+        Pipe * pending;         // for the command being parsed to read
+        Pipe * reading;         // input, when that's a pipe
+        int pipeline(Invocation * run, CommandEntry * aCmd, char * rest);
+        void pipeTurn(Pipe & pipe, bool cancel);
+        void pushTurn(Pipe & pipe);
+        bool endPipe(Pipe * pipe);
+        bool keep(Invocation * run);
+
+        bool frames;
+        int frameGot;           // bytes of a frame read so far, or -1
+        unsigned long frameTime;    // when its last byte came
+        struct FrameNumber;
+        FrameNumber * numbers;  // numeric arguments of the framed request
+        int numberCount;
+        bool frameWaiting(void);
+        bool frameInput(int budget);
+        void runFrame(void);
+        void frameReply(int id, int status, long result);
+        const FrameNumber * frameNumber(const char * arg) const;
+        static bool commandAt(int id, CommandEntry & found);
+        void redirect(Invocation & inv, bool on);
+        bool finish(Invocation & inv);
+        EDITLINE editor;
+        bool lineTaken;         // the editor's line went to a command; a prompt is owed
+        void reprompt(void);
+        static SimpleSerialShell * running;  // session executing a command
+        Stream * connection(void);
+        Stream * inputConnection(void);
+
+        // editor callbacks; user is the owning shell
+        static int editorWaiting(void * user);
+        static int editorGet(void * user);
+        static void editorPut(void * user, const char * buf, size_t len);
+        static int editorComplete(void * user, const char * line, int start, int end, char * buf, int size);
+        static void editorList(void * user, const char * line, int start, int end);
+
+        int dispatch(char * line, bool typed);
+        int execute(bool typed);
+        int launch(Invocation * run, CommandEntry * aCmd, bool inBackground);
         // int execute(int argc, char** argv);
 
-        bool prepInput(void);
+        // The line is followed as it's typed, and the command looked up
+        // as soon as its first word is complete, so Enter runs it at once.
+        enum EarlyLookup { UNSEEN, FOUND, MISSING, LATE };
+        size_t scanned;         // characters of the line looked at
+        int firstWord;          // where the first word starts, or -1
+        EarlyLookup early;
+        CommandEntry earlyCmd;
+        void scanLine(const char * line, size_t end, bool complete);
+        void rescan(void);
+        void lookUpEarly(const char * name, size_t len);
 
-        static const char BUFSIZE = 88;
-        static const char MAXARGS = 10;
-        char linebuffer[BUFSIZE];
+        char * linebuffer;      // also the editor's line
+        size_t lineSize;
+        char * cmdLine;         // the line being run, split in place
+        size_t cmdSize;
+        char ** args;       // argv of the command being run
+        int maxArgs;
         int inptr;
+        static char * nextWord(char * & p);
         int (*fallback)(int argc, char **argv);
         char *(*stringExpand)(char *name);
         float (*floatExpand)(char *name);
@@ -72,10 +390,59 @@ class SimpleSerialShell : public Stream {
         Stream *(*consoleChange)(Stream *c, SdFile *f);
         class Command;
         static Command * firstCommand;
+        static void insert(Command * newCmd);
+
+        struct CommandTable;
+        static CommandTable * firstTable;
+
+        // sorted index over the command list, for binary search lookup.
+        // Rebuilt lazily after addCommand().
+        static Command ** commandIndex;
+        static int numCommands;
+        static bool indexStale;
+        static bool buildIndex(void);
+        static bool findCommand(const char * aName, CommandEntry & found);
+
+        class Completion;
+        int completions(Completion & c, const char * line, int start);
+        static void completeCommands(Completion & c);
+        static bool selected(PGM_P name);
+        void completeFiles(Completion & c);
+
+        // case insensitive name comparison usable at compile time
+        static constexpr int lower(char c)
+        {
+            return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+        static constexpr int nameOrder(const char * a, const char * b)
+        {
+            return (lower(*a) != lower(*b) || *a == '\0') ?
+                   lower(*a) - lower(*b) : nameOrder(a + 1, b + 1);
+        }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/*!
+ *  A shell with room for LINE character lines (including the NUL) and
+ *  ARGS arguments, e.g.
+ *
+ *      SizedSerialShell<512, 32> console;  // long configuration lines
+ *      SizedSerialShell<> remote;          // the usual size
+ */
+template <size_t LINE = SHELL_LINE_SIZE, int ARGS = SHELL_MAXARGS>
+class SizedSerialShell : public SimpleSerialShell {
+    public:
+        SizedSerialShell(void)
+            : SimpleSerialShell(lineStorage, LINE, argStorage, ARGS) {}
+
+    private:
+        char lineStorage[LINE];
+        char * argStorage[ARGS];
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-extern SimpleSerialShell shell;
+// the default shell, a SizedSerialShell<>
+extern SimpleSerialShell & shell;
 
 //example commands which would be easy to add to the shell:
 //extern int helloWorld(int argc, char **argv);
@@ -24,25 +24,38 @@
  */
 
 /*
+**  Main editing routines for editline library.
+*/
+#include "editline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
 
-Defines TODO
+#define CRLF    "\r\n"
+#define FORWARD   STATIC
 
-advanced commands (search, emacs, etc)
+#if	!defined(SIZE_T)
+#define SIZE_T	unsigned int
+#endif	/* !defined(SIZE_T) */
 
-static memory (fixed max line length)
- + history depth
+typedef unsigned char	CHAR;
 
-pass line char array to readline
+#define STATIC	static
 
+#define CONST	const
 
-*/
+#define MEM_INC		64
+#define SCREEN_INC	256
 
-/*
-**  Main editing routines for editline library.
-*/
-#include "editline.h"
-#include <ctype.h>
-#include <unistd.h>
+#define DISPOSE(p)	free((char*)(p))
+#define NEW(T, c)	\
+	((T*)malloc((unsigned int)(sizeof (T) * (c))))
+#define RENEW(p, T, c)	\
+	(p = (T*)realloc((char*)(p), (unsigned int)(sizeof (T) * (c))))
+#define COPYFROMTO(new, p, len)	\
+	(void)memcpy((char*)(new), (char*)(p), (int)(len))
 
 /*
 **  Manifest constants.
@@ -57,9 +70,9 @@ pass line char array to readline
 #define META(x)         ((x) | 0x80)
 #define ISMETA(x)       ((x) & 0x80)
 #define UNMETA(x)       ((x) & 0x7F)
-#if     !defined(HIST_SIZE)
-#define HIST_SIZE       20
-#endif  /* !defined(HIST_SIZE) */
+#if     !defined(INPUT_BUDGET)
+#define INPUT_BUDGET    64      /* max chars handled per readline() call */
+#endif  /* !defined(INPUT_BUDGET) */
 
 /*
 **  Command status codes.
@@ -83,14 +96,9 @@ typedef struct _KEYMAP {
     STATUS      (*Function)();
 } KEYMAP;
 
-/*
-**  Command history structure.
-*/
-typedef struct _HISTORY {
-    int         Size;
-    int         Pos;
-    CHAR        *Lines[HIST_SIZE];
-} HISTORY;
+#define HIST_MAXLEN     255     /* longer lines are not remembered */
+#define COMPLETE_MAX    32      /* most chars added by one Tab */
+#define HIST_AT(off)    H.Arena[(H.Oldest + (off)) % HIST_BYTES]
 
 /*
 **  Globals.
@@ -103,31 +111,48 @@ static const unsigned rl_quit = 0x1C;
 
 STATIC CHAR             NIL[] = "";
 STATIC CONST CHAR       *Input = NIL;
-STATIC CHAR             *Line;
-STATIC CONST char       *Prompt;
-STATIC char             *Screen;
 STATIC CONST char       NEWLINE[]= CRLF;
-STATIC HISTORY          H;
-STATIC int              Repeat;
-STATIC int              End;
-STATIC int              Mark;
-STATIC int              OldPoint;
-STATIC int              Point;
-STATIC int              PushBack;
-STATIC int              Pushed;
-FORWARD CONST KEYMAP    Map[26];
-STATIC SIZE_T           Length;
-STATIC SIZE_T           ScreenCount;
-STATIC SIZE_T           ScreenSize;
+FORWARD CONST KEYMAP    Map[28];
 STATIC char             *backspace;
 
+/*
+**  The session being served.  Every entry point sets it, and the names
+**  below refer to its editing state.
+*/
+STATIC EDITLINE         *el;
+#define Line            (el->Line)
+#define Prompt          (el->Prompt)
+#define Screen          (el->Screen)
+#define H               (el->H)
+#define Repeat          (el->Repeat)
+#define End             (el->End)
+#define Mark            (el->Mark)
+#define OldPoint        (el->OldPoint)
+#define Point           (el->Point)
+#define PushBack        (el->PushBack)
+#define Pushed          (el->Pushed)
+#define Length          (el->Length)
+#define ScreenCount     (el->ScreenCount)
+#define ScreenSize      (el->ScreenSize)
+#define ScreenBuf       (el->ScreenBuf)
+#define Searching       (el->Searching)
+#define Pattern         (el->Pattern)
+#define PatLen          (el->PatLen)
+#define Match           (el->Match)
+#define Shown           (el->Shown)
+#define Cursor          (el->Cursor)
+#define Budget          (el->Budget)
+#define FixedLine       (el->FixedLine)
+#define Overflow        (el->Overflow)
+#define Changed         (el->Changed)
+
 /* Display print 8-bit chars as `M-x' or as the actual 8-bit char? */
 int             rl_meta_chars = 0;
 
 /*
 **  Declarations.
 */
-STATIC CHAR     *editinput();
+STATIC CHAR     *editinput(int budget);
 #if     defined(USE_TERMCAP)
 #include <stdlib.h>
 #include <curses.h>
@@ -142,16 +167,9 @@ STATIC CHAR     *editinput();
 STATIC void
 TTYflush()
 {
-    SIZE_T s;
     if (ScreenCount) {
-        /* Dummy assignment avoids GCC warning on
-         * "attribute warn_unused_result" */
-//        ssize_t dummy = write(1, Screen, ScreenCount);
-//        (void)dummy;
-
-        for (s = 0; s < ScreenCount; s++)
-          _putchar(Screen[s]);
-
+        /* One bulk write, so the stream can send it as one packet. */
+        el->Put(el->User, Screen, ScreenCount);
         ScreenCount = 0;
     }
 }
@@ -162,8 +180,12 @@ TTYput(c)
 {
     Screen[ScreenCount] = c;
     if (++ScreenCount >= ScreenSize - 1) {
+#if     defined(STATIC_MEMORY)
+        TTYflush();
+#else
         ScreenSize += SCREEN_INC;
         RENEW(Screen, char, ScreenSize);
+#endif  /* defined(STATIC_MEMORY) */
     }
 }
 
@@ -175,10 +197,25 @@ TTYputs(p)
         TTYput(*p++);
 }
 
+STATIC int
+TTYwidth(c)
+    CHAR        c;
+{
+    if (c == DEL || ISCTL(c))
+        return 2;
+    if (rl_meta_chars && ISMETA(c))
+        return 3;
+    return 1;
+}
+
+/*
+**  Show a character of the line; keeps track of the cursor column.
+*/
 STATIC void
 TTYshow(c)
     CHAR        c;
 {
+    Cursor += TTYwidth(c);
     if (c == DEL) {
         TTYput('^');
         TTYput('?');
@@ -214,7 +251,7 @@ TTYget()
     }
     if (*Input)
         return *Input++;
-    return _getchar(); //read(0, &c, (SIZE_T)1) == 1 ? c : EOF;
+    return el->Get(el->User);
 }
 
 #define TTYback()       (backspace ? TTYputs((CHAR *)backspace) : TTYput('\b'))
@@ -227,30 +264,99 @@ TTYbackn(n)
         TTYback();
 }
 
+/*
+**  Send ESC [ n c, an ANSI cursor movement or insert/delete sequence.
+*/
 STATIC void
-reposition()
+TTYcsi(n, c)
+    int         n;
+    CHAR        c;
 {
+    CHAR        digits[6];
+    int         i;
+
+    TTYput('\033');
+    TTYput('[');
+    i = 0;
+    do {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    while (i)
+        TTYput(digits[--i]);
+    TTYput(c);
+}
+
+/*
+**  Display columns taken by the first i characters of the line.
+*/
+STATIC int
+column(i)
     int         i;
+{
+    int         col;
     CHAR        *p;
 
-    TTYput('\r');
-    TTYputs((CONST CHAR *)Prompt);
-    for (i = Point, p = Line; --i >= 0; p++)
-        TTYshow(*p);
+    for (col = 0, p = Line; --i >= 0; p++)
+        col += TTYwidth(*p);
+    return col;
+}
+
+/*
+**  Move the cursor to column col of the line, whichever way sends least:
+**  backspaces, CR and retyping, or ANSI cursor movement.  The terminal
+**  is assumed to show the line as it is now.
+*/
+STATIC void
+TTYmove(col)
+    int         col;
+{
+    int         n;
+    int         c;
+    CHAR        *p;
+
+    if (col < Cursor) {
+        n = Cursor - col;
+        if (el->Ansi && n > 3)
+            TTYcsi(n, 'D');
+        else if (1 + (int)strlen(Prompt) + col < n) {
+            TTYput('\r');
+            TTYputs((CONST CHAR *)Prompt);
+            for (Cursor = 0, p = Line; Cursor < col; p++)
+                TTYshow(*p);
+        }
+        else
+            TTYbackn(n);
+    }
+    else if (col > Cursor) {
+        if (el->Ansi && col - Cursor > 3)
+            TTYcsi(col - Cursor, 'C');
+        else {
+            for (c = 0, p = Line; c < Cursor; p++)
+                c += TTYwidth(*p);
+            while (Cursor < col)
+                TTYshow(*p++);
+        }
+    }
+    Cursor = col;
+}
+
+STATIC void
+reposition()
+{
+    TTYmove(column(Point));
 }
 
 STATIC void
 left(Change)
     STATUS      Change;
 {
-    TTYback();
+    int         i;
+
     if (Point) {
-        if (ISCTL(Line[Point - 1]))
-            TTYback();
-        else if (rl_meta_chars && ISMETA(Line[Point - 1])) {
-            TTYback();
-            TTYback();
-        }
+        i = TTYwidth(Line[Point - 1]);
+        Cursor -= i;
+        TTYbackn(i);
     }
     if (Change == CSmove)
         Point--;
@@ -265,6 +371,15 @@ right(Change)
         Point++;
 }
 
+/* The line from position p on is about to change. */
+STATIC void
+edited(p)
+    int         p;
+{
+    if (p < Changed)
+        Changed = p;
+}
+
 STATIC STATUS
 ring_bell()
 {
@@ -280,6 +395,10 @@ ceol()
     int         i;
     CHAR        *p;
 
+    if (el->Ansi) {
+        TTYputs((CONST CHAR *)"\033[K");
+        return;
+    }
     for (extras = 0, i = Point, p = &Line[i]; i <= End; i++, p++) {
         TTYput(' ');
         if (ISCTL(*p)) {
@@ -308,6 +427,15 @@ insert_string(p)
 
     len = strlen((char *)p);
     if (End + len >= Length) {
+#if     defined(STATIC_MEMORY)
+        (void)new;
+        Overflow = 1;
+        return ring_bell();
+#else
+        if (FixedLine) {
+            Overflow = 1;
+            return ring_bell();
+        }
         if ((new = NEW(CHAR, Length + len + MEM_INC)) == NULL)
             return CSstay;
         if (Length) {
@@ -316,13 +444,27 @@ insert_string(p)
         }
         Line = new;
         Length += len + MEM_INC;
+#endif  /* defined(STATIC_MEMORY) */
     }
 
+    edited(Point);
     for (q = &Line[Point], i = End - Point; --i >= 0; )
         q[len + i] = q[i];
     COPYFROMTO(&Line[Point], p, len);
     End += len;
     Line[End] = '\0';
+
+    if (el->Ansi && Point + (int)len < End) {
+        /* Open a gap and show just the new characters. */
+        for (i = 0, q = p; *q; q++)
+            i += TTYwidth(*q);
+        TTYcsi(i, '@');
+        for (q = p; *q; q++)
+            TTYshow(*q);
+        Point += len;
+        return CSstay;
+    }
+
     TTYstring(&Line[Point]);
     Point += len;
 
@@ -334,48 +476,68 @@ redisplay()
 {
     TTYputs((CONST CHAR *)NEWLINE);
     TTYputs((CONST CHAR *)Prompt);
+    Cursor = 0;
     TTYstring(Line);
     return CSmove;
 }
 
-STATIC CHAR *
+STATIC int
 next_hist()
 {
-    return H.Pos >= H.Size - 1 ? NULL : H.Lines[++H.Pos];
+    if (H.Pos >= H.Used)
+        return 0;
+    H.Pos += HIST_AT(H.Pos) + 2;
+    return 1;
 }
 
-STATIC CHAR *
+STATIC int
 prev_hist()
 {
-    return H.Pos == 0 ? NULL : H.Lines[--H.Pos];
+    if (H.Pos == 0)
+        return 0;
+    H.Pos -= HIST_AT(H.Pos - 1) + 2;
+    return 1;
 }
 
+/*
+**  Replace the line with history line Pos (empty past the newest).
+*/
 STATIC STATUS
-do_insert_hist(p)
-    CHAR        *p;
+do_insert_hist()
 {
-    if (p == NULL)
-        return ring_bell();
+    SIZE_T      len;
+    SIZE_T      i;
+    CHAR        buff[2];
+
     Point = 0;
     reposition();
     ceol();
+    edited(0);
     End = 0;
-    return insert_string(p);
+    Line[0] = '\0';
+    Overflow = 0;
+
+    len = H.Pos < H.Used ? HIST_AT(H.Pos) : 0;
+    buff[1] = '\0';
+    for (i = 0; i < len && End < (int)Length - 1; i++) {
+        buff[0] = HIST_AT(H.Pos + 1 + i);
+        (void)insert_string(buff);
+    }
+    return CSstay;
 }
 
 STATIC STATUS
 do_hist(move)
-    CHAR        *(*move)();
+    int         (*move)();
 {
-    CHAR        *p;
     int         i;
 
     i = 0;
     do {
-        if ((p = (*move)()) == NULL)
+        if (!(*move)())
             return ring_bell();
     } while (++i < Repeat);
-    return do_insert_hist(p);
+    return do_insert_hist();
 }
 
 STATIC STATUS
@@ -390,6 +552,179 @@ h_prev()
     return do_hist(prev_hist);
 }
 
+/*
+**  Incremental reverse search (Ctrl-R).  Each key narrows the search,
+**  continuing back from the current match rather than rescanning.
+*/
+STATIC int
+hist_match(off)
+    SIZE_T      off;
+{
+    SIZE_T      len;
+    SIZE_T      i;
+    int         j;
+
+    len = HIST_AT(off);
+    for (i = 0; i + PatLen <= len; i++) {
+        for (j = 0; j < PatLen && HIST_AT(off + 1 + i + j) == Pattern[j]; j++)
+            continue;
+        if (j == PatLen)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+**  Find the newest line at or before off containing Pattern.
+*/
+STATIC int
+hist_search(off)
+    SIZE_T      off;
+{
+    while (off < H.Used) {
+        if (hist_match(off)) {
+            Match = off;
+            return 1;
+        }
+        if (off == 0)
+            break;
+        off -= HIST_AT(off - 1) + 2;
+    }
+    return 0;
+}
+
+STATIC SIZE_T
+newest_hist()
+{
+    return H.Used ? H.Used - HIST_AT(H.Used - 1) - 2 : H.Used;
+}
+
+/*
+**  Redraw the whole line: the search string and match while searching,
+**  else the prompt and Line.  Leftovers of the last redraw are blanked.
+*/
+STATIC void
+search_show()
+{
+    SIZE_T      len;
+    SIZE_T      i;
+    int         width;
+    int         j;
+    CHAR        c;
+
+    TTYput('\r');
+    if (Searching) {
+        TTYputs((CONST CHAR *)"(reverse-i-search)`");
+        TTYstring(Pattern);
+        TTYputs((CONST CHAR *)"': ");
+        width = 22 + PatLen;
+        len = Match < H.Used ? HIST_AT(Match) : 0;
+    }
+    else {
+        TTYputs((CONST CHAR *)Prompt);
+        width = strlen(Prompt);
+        len = End;
+    }
+    Cursor = 0;
+    for (i = 0; i < len; i++) {
+        c = Searching ? HIST_AT(Match + 1 + i) : Line[i];
+        TTYshow(c);
+        width += TTYwidth(c);
+    }
+    for (j = width; j < Shown; j++)
+        TTYput(' ');
+    for (; j > width; j--)
+        TTYback();
+    Shown = width;
+}
+
+STATIC STATUS
+h_search()
+{
+    int         i;
+
+    Searching = 1;
+    PatLen = 0;
+    Pattern[0] = '\0';
+    Match = H.Used;
+    for (Shown = strlen(Prompt), i = 0; i < End; i++)
+        Shown += TTYwidth(Line[i]);
+    search_show();
+    return CSstay;
+}
+
+/*
+**  Leave search mode with the match (if any) as the line to edit.
+*/
+STATIC void
+search_done()
+{
+    SIZE_T      len;
+    SIZE_T      i;
+
+    Searching = 0;
+    if (Match < H.Used) {
+        H.Pos = Match;
+        len = HIST_AT(Match);
+        Overflow = len >= Length;
+        if (Overflow)
+            len = Length - 1;
+        edited(0);
+        for (i = 0; i < len; i++)
+            Line[i] = HIST_AT(Match + 1 + i);
+        Line[len] = '\0';
+        Point = End = len;
+    }
+    search_show();
+    reposition();
+}
+
+STATIC STATUS
+search_char(c)
+    unsigned int        c;
+{
+    if (c == CTL('R')) {
+        /* Next older match. */
+        if (Match == 0
+         || !hist_search(Match < H.Used ? Match - HIST_AT(Match - 1) - 2 : newest_hist()))
+            return ring_bell();
+        search_show();
+        return CSstay;
+    }
+    if (c == CTL('G')) {
+        /* Give up, back to the line as it was. */
+        Searching = 0;
+        Match = H.Used;
+        search_show();
+        return ring_bell();
+    }
+    if (c == DEL || c == CTL('H')) {
+        if (PatLen == 0)
+            return ring_bell();
+        Pattern[--PatLen] = '\0';
+        Match = H.Used;
+        (void)hist_search(newest_hist());
+        search_show();
+        return CSstay;
+    }
+    if (ISCTL(c) || ISMETA(c)) {
+        /* Any other control key ends the search and is then handled
+         * as usual (so Enter runs the line found). */
+        search_done();
+        return CSdispatch;
+    }
+    if (PatLen >= SEARCH_MAX - 1)
+        return ring_bell();
+    Pattern[PatLen++] = c;
+    Pattern[PatLen] = '\0';
+    if (!hist_search(Match < H.Used ? Match : newest_hist())) {
+        Pattern[--PatLen] = '\0';
+        return ring_bell();
+    }
+    search_show();
+    return CSstay;
+}
+
 STATIC STATUS
 fd_char()
 {
@@ -409,6 +744,7 @@ delete_string(count)
     int         count;
 {
     int         i;
+    int         width;
     CHAR        *p;
 
     if (count <= 0 || End == Point)
@@ -416,7 +752,9 @@ delete_string(count)
 
     if (count == 1 && Point == End - 1) {
         /* Optimize common case of delete at end of line. */
+        edited(Point);
         End--;
+        Overflow = 0;   /* back under the limit; what was dropped is let go */
         p = &Line[Point];
         i = 1;
         TTYput(' ');
@@ -436,11 +774,24 @@ delete_string(count)
     if (Point + count > End && (count = End - Point) <= 0)
         return CSstay;
 
+    edited(Point);
+    for (width = 0, i = 0; i < count; i++)
+        width += TTYwidth(Line[Point + i]);
     for (p = &Line[Point], i = End - (Point + count) + 1; --i >= 0; p++)
         p[0] = p[count];
-    ceol();
     End -= count;
+    Overflow = 0;
+
+    if (el->Ansi) {
+        TTYcsi(width, 'P');
+        return CSstay;
+    }
+
+    /* Retype the rest of the line and blank what's left over. */
     TTYstring(&Line[Point]);
+    for (i = 0; i < width; i++)
+        TTYput(' ');
+    Cursor += width;
     return CSmove;
 }
 
@@ -493,8 +844,11 @@ kill_line()
         return CSmove;
     }
 
+    edited(Point);
     Line[Point] = '\0';
     ceol();
+    if (End > Point)
+        Overflow = 0;
     End = Point;
     return CSstay;
 }
@@ -515,6 +869,14 @@ insert_char(c)
         return insert_string(buff);
     }
 
+#if     defined(STATIC_MEMORY)
+    buff[0] = c;
+    buff[1] = '\0';
+    for (i = Repeat, Repeat = 0, s = CSstay; --i >= 0 && End < (int)Length - 1; )
+        s = insert_string(buff);
+    (void)p; (void)q;
+    return s;
+#else
     if ((p = NEW(CHAR, Repeat + 1)) == NULL)
         return CSstay;
     for (i = Repeat, q = p; --i >= 0; )
@@ -524,6 +886,7 @@ insert_char(c)
     s = insert_string(p);
     DISPOSE(p);
     return s;
+#endif  /* defined(STATIC_MEMORY) */
 }
 
 STATIC STATUS
@@ -601,31 +964,29 @@ TTYspecial(c)
     return CSdispatch;
 }
 
+/*
+**  Handle whatever input is waiting (up to budget chars), so a pasted
+**  line is edited in one call.  Echo is flushed once at the end.
+*/
 STATIC CHAR *
-editinput()
+editinput(budget)
+    int                 budget;
 {
     unsigned int        c;
+    STATUS              s;
 
-    if (_waitchar(0) == 0)
-        return NULL;
+    while (budget-- > 0 && el->Waiting(el->User) > 0) {
+        c = el->Get(el->User);
 
-    c = _getchar();
+        s = Searching ? search_char(c) : CSdispatch;
+        if (s == CSdispatch && (s = TTYspecial(c)) == CSdispatch)
+            s = emacs(c);
 
-    switch (TTYspecial(c)) {
-        case CSdone:
-            return Line;
-        case CSeof:
-            return NULL;
-        case CSsignal:
-            return (CHAR *)"";
-        case CSmove:
-            reposition();
-            break;
-        case CSdispatch:
-            switch (emacs(c)) {
+        switch (s) {
             case CSdone:
                 return Line;
             case CSeof:
+                TTYflush();
                 return NULL;
             case CSsignal:
                 return (CHAR *)"";
@@ -635,10 +996,7 @@ editinput()
             case CSdispatch:
             case CSstay:
                 break;
-            }
-            break;
-        case CSstay:
-            break;
+        }
     }
     TTYflush();
     return NULL;
@@ -648,19 +1006,26 @@ STATIC void
 hist_add(p)
     CHAR        *p;
 {
-    int         i;
+    SIZE_T      len;
+    SIZE_T      i;
 
-    if ((p = (CHAR *)strdup((char *)p)) == NULL)
+    len = strlen((char *)p);
+    if (len > HIST_MAXLEN || len + 2 > HIST_BYTES)
         return;
-    if (H.Size < HIST_SIZE)
-        H.Lines[H.Size++] = p;
-    else {
-        DISPOSE(H.Lines[0]);
-        for (i = 0; i < HIST_SIZE - 1; i++)
-            H.Lines[i] = H.Lines[i + 1];
-        H.Lines[i] = p;
+
+    /* Drop the oldest lines until this one fits. */
+    while (H.Used + len + 2 > HIST_BYTES) {
+        i = HIST_AT(0) + 2;
+        H.Oldest = (H.Oldest + i) % HIST_BYTES;
+        H.Used -= i;
     }
-    H.Pos = H.Size - 1;
+
+    HIST_AT(H.Used) = len;
+    for (i = 0; i < len; i++)
+        HIST_AT(H.Used + 1 + i) = p[i];
+    HIST_AT(H.Used + 1 + len) = len;
+    H.Used += len + 2;
+    H.Pos = H.Used;
 }
 
 /*
@@ -679,17 +1044,48 @@ rl_initialize()
 {
 }
 
+/*
+**  Clear a session's editing state and history.  Set the callbacks
+**  afterwards.
+*/
+void
+rl_init(e)
+    EDITLINE    *e;
+{
+    memset(e, 0, sizeof *e);
+}
+
+/*
+**  Release what the editor allocated (nothing with STATIC_MEMORY).
+*/
+void
+rl_free(e)
+    EDITLINE    *e;
+{
+#if     !defined(STATIC_MEMORY)
+    el = e;
+    DISPOSE(Screen);
+    Screen = NULL;
+    if (!FixedLine) {
+        DISPOSE(Line);
+        Line = NULL;
+    }
+#else
+    (void)e;
+#endif  /* !defined(STATIC_MEMORY) */
+}
+
 char *
-readline(void)
+readline(e)
+    EDITLINE    *e;
 {
     CHAR        *line;
 
-    if ((line = editinput()) != NULL) {
+    el = e;
+    if ((line = editinput(Budget > 0 ? Budget : INPUT_BUDGET)) != NULL) {
     //    line = (CHAR *)strdup((char *)line);
         TTYputs((CONST CHAR *)NEWLINE);
         TTYflush();
-        DISPOSE(Screen);
-        DISPOSE(H.Lines[--H.Size]);
         return (char *)line;
     }
 
@@ -697,35 +1093,63 @@ readline(void)
 }
 
 void
-resetline(char *prompt)
+resetline(e, prompt)
+    EDITLINE    *e;
+    CONST char  *prompt;
 {
+    el = e;
     if (Line == NULL) {
+#if     defined(STATIC_MEMORY)
+        return;                 /* the owner didn't give us a line */
+#else
         Length = MEM_INC;
         if ((Line = NEW(CHAR, Length)) == NULL)
-            return NULL;
+            return;
+#endif  /* defined(STATIC_MEMORY) */
     }
 
     Repeat = NO_ARG;
+    Searching = 0;
     OldPoint = Point = Mark = End = 0;
     Line[0] = '\0'; 
-
-    hist_add(NIL);
-    ScreenSize = SCREEN_INC;
-    Screen = NEW(char, ScreenSize);
-    Prompt = prompt ? prompt : (char *)NIL;
+    Changed = 0;
+    Overflow = 0;
+
+    H.Pos = H.Used;
+#if     defined(STATIC_MEMORY)
+    ScreenSize = SCREEN_SIZE;
+    Screen = ScreenBuf;
+#else
+    if (Screen == NULL) {       /* kept from line to line */
+        ScreenSize = SCREEN_INC;
+        Screen = NEW(char, ScreenSize);
+    }
+#endif  /* defined(STATIC_MEMORY) */
+    Prompt = prompt ? prompt : (CONST char *)NIL;
     TTYputs((CONST CHAR *)Prompt); TTYflush();
+    Cursor = 0;
 }
 
 void
-add_history(p)
-    char        *p;
+add_history(e, p)
+    EDITLINE    *e;
+    CONST char  *p;
 {
+    el = e;
     if (p == NULL || *p == '\0')
         return;
 
 #if     defined(UNIQUE_HISTORY)
-    if (H.Size && strcmp(p, (char *)H.Lines[H.Size - 1]) == 0)
-        return;
+    if (H.Used) {
+        SIZE_T  len = HIST_AT(H.Used - 1);
+        SIZE_T  i;
+        CHAR    *q = (CHAR *)p;
+
+        for (i = 0; i < len && q[i] == HIST_AT(H.Used - 1 - len + i); i++)
+            continue;
+        if (i == len && q[i] == '\0')
+            return;
+    }
 #endif  /* defined(UNIQUE_HISTORY) */
     hist_add((CHAR *)p);
 }
@@ -769,11 +1193,12 @@ transpose()
 {
     CHAR        c;
 
-    if (Point) {
+    if (Point && End > 1) {
         if (Point == End)
             left(CSmove);
         c = Line[Point - 1];
         left(CSstay);
+        edited(Point - 1);
         Line[Point - 1] = Line[Point];
         TTYshow(Line[Point - 1]);
         Line[Point++] = c;
@@ -800,6 +1225,39 @@ wipe()
     return delete_string(Mark - Point);
 }
 
+/*
+**  Tab: complete the word before the cursor as far as it is unambiguous;
+**  if nothing could be added, list the possibilities.
+*/
+STATIC STATUS
+c_complete()
+{
+    CHAR        buff[COMPLETE_MAX];
+    int         start;
+    int         n;
+
+    for (start = Point; start > 0 && !isspace(Line[start - 1]); start--)
+        continue;
+    if (el->Complete == NULL)
+        return ring_bell();
+    n = el->Complete(el->User, (CONST char *)Line, start, Point, (char *)buff, sizeof buff);
+    if (n == 0)
+        return ring_bell();
+    if (buff[0])
+        return insert_string(buff);
+    if (n == 1)
+        return CSstay;
+
+    TTYputs((CONST CHAR *)NEWLINE);
+    TTYflush();
+    if (el->List)
+        el->List(el->User, (CONST char *)Line, start, Point);
+    TTYputs((CONST CHAR *)Prompt);
+    Cursor = 0;
+    TTYstring(Line);
+    return CSmove;
+}
+
 STATIC STATUS
 move_to_char()
 {
@@ -817,7 +1275,7 @@ move_to_char()
     return CSstay;
 }
 
-STATIC CONST KEYMAP Map[26] = {
+STATIC CONST KEYMAP Map[28] = {
     {   CTL('@'),       ring_bell       },
     {   CTL('A'),       beg_line        },
     {   CTL('B'),       bk_char         },
@@ -826,6 +1284,7 @@ STATIC CONST KEYMAP Map[26] = {
     {   CTL('F'),       fd_char         },
     {   CTL('G'),       ring_bell       },
     {   CTL('H'),       bk_del_char     },
+    {   CTL('I'),       c_complete      },
     {   CTL('J'),       accept_line     },
     {   CTL('K'),       kill_line       },
     {   CTL('L'),       redisplay       },
@@ -834,6 +1293,7 @@ STATIC CONST KEYMAP Map[26] = {
     {   CTL('O'),       ring_bell       },
     {   CTL('P'),       h_prev          },
     {   CTL('Q'),       ring_bell       },
+    {   CTL('R'),       h_search        },
     {   CTL('S'),       ring_bell       },
     {   CTL('T'),       transpose       },
     {   CTL('U'),       ring_bell       },
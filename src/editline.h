@@ -31,49 +31,98 @@ extern "C" {
  */
 
 /*
-**  Internal header file for editline library.
+**  Interface to the line editor.  All editing state (line, history,
+**  screen) lives in an EDITLINE, so each shell session has its own and
+**  several streams can be edited at once.
 */
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#define CRLF    "\r\n"
-#define FORWARD   STATIC
-
-#if	!defined(SIZE_T)
-#define SIZE_T	unsigned int
-#endif	/* !defined(SIZE_T) */
-
-typedef unsigned char	CHAR;
-
-#define STATIC	static
-
-#define CONST	const
-
-#define MEM_INC		64
-#define SCREEN_INC	256
-
-#define DISPOSE(p)	free((char*)(p))
-#define NEW(T, c)	\
-	((T*)malloc((unsigned int)(sizeof (T) * (c))))
-#define RENEW(p, T, c)	\
-	(p = (T*)realloc((char*)(p), (unsigned int)(sizeof (T) * (c))))
-#define COPYFROMTO(new, p, len)	\
-	(void)memcpy((char*)(new), (char*)(p), (int)(len))
+#include <stddef.h>
 
+#if     !defined(HIST_BYTES)
+#define HIST_BYTES      256     /* history arena size */
+#endif  /* !defined(HIST_BYTES) */
 
 /*
-**  Variables and routines internal to this package.
+**  With STATIC_MEMORY defined the screen buffer is a fixed array and
+**  nothing is malloc'ed (history always is a fixed arena); the owner must
+**  supply the line buffer (see FixedLine).
 */
-extern char	*rl_complete();
-extern int	rl_list_possib();
-extern void	rl_ttyset(int);
-extern void	rl_add_slash();
+#if     defined(STATIC_MEMORY)
+#if     !defined(SCREEN_SIZE)
+#define SCREEN_SIZE     128     /* output is flushed when full */
+#endif  /* !defined(SCREEN_SIZE) */
+#endif  /* defined(STATIC_MEMORY) */
 
-char *readline(void);
-void resetline(char  *prompt);
+#define SEARCH_MAX      32      /* longest Ctrl-R search string + 1 */
 
-void add_history(char *p);
+/*
+**  Command history.  Lines are packed into a circular byte arena as
+**  len, chars..., len  so it can be walked either way; the oldest lines
+**  are dropped to make room.  Offsets are logical (0 is the start of the
+**  oldest line, Used is just past the newest).
+*/
+typedef struct _HISTORY {
+    unsigned int        Oldest;         /* arena index of the oldest line */
+    unsigned int        Used;           /* bytes in use */
+    unsigned int        Pos;            /* line being browsed, Used if none */
+    unsigned char       Arena[HIST_BYTES];
+} HISTORY;
+
+typedef struct _EDITLINE {
+    /* Supplied by the owner, after rl_init(). */
+    void                *User;
+    int                 (*Waiting)(void *user);         /* chars ready? */
+    int                 (*Get)(void *user);
+    void                (*Put)(void *user, const char *buf, size_t len);
+    /* Tab completion of line[start..end): copy what to add to buf and
+     * return the number of candidates; List prints the candidates. */
+    int                 (*Complete)(void *user, const char *line,
+                                    int start, int end, char *buf, int size);
+    void                (*List)(void *user, const char *line, int start, int end);
+    int                 Ansi;           /* terminal handles ANSI sequences */
+    int                 Budget;         /* most chars read per readline(), 0: default */
+    /* To edit in your own buffer, set Line and Length (its size) and
+     * FixedLine after rl_init().  Lines that don't fit ring the bell. */
+    int                 FixedLine;
+    /* Set when typing didn't fit and was dropped, so the owner can
+     * refuse the line; deleting (which makes room) and resetline()
+     * clear it. */
+    int                 Overflow;
+    /* Lowest position edited since the owner last set it (resetline()
+     * sets 0), so the owner can follow a line as it's typed. */
+    int                 Changed;
+
+    /* Editing state. */
+    unsigned char       *Line;
+    const char          *Prompt;
+    char                *Screen;
+    int                 Repeat;
+    int                 End;
+    int                 Mark;
+    int                 OldPoint;
+    int                 Point;
+    int                 PushBack;
+    int                 Pushed;
+    unsigned int        Length;
+    unsigned int        ScreenCount;
+    unsigned int        ScreenSize;
+    int                 Searching;      /* in Ctrl-R search? */
+    unsigned char       Pattern[SEARCH_MAX];
+    int                 PatLen;
+    unsigned int        Match;          /* history line found, or H.Used */
+    int                 Shown;          /* width of the search display */
+    int                 Cursor;         /* terminal column, after Prompt */
+    HISTORY             H;
+#if     defined(STATIC_MEMORY)
+    char                ScreenBuf[SCREEN_SIZE];
+#endif  /* defined(STATIC_MEMORY) */
+} EDITLINE;
+
+void rl_init(EDITLINE *e);
+void rl_free(EDITLINE *e);
+char *readline(EDITLINE *e);
+void resetline(EDITLINE *e, const char *prompt);
+
+void add_history(EDITLINE *e, const char *p);
 
 
 #ifdef __cplusplus